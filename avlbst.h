@@ -6,6 +6,9 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <iterator>
+#include <vector>
+#include <limits>
 #include "bst.h"
 
 struct KeyError { };
@@ -14,6 +17,12 @@ struct KeyError { };
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+*
+* Building with AVL_COMPACT_NODES defined drops the balance_ member and stores the
+* balance in the low bits of the parent pointer instead, which saves a word per node
+* (an AVLNode<uint64_t, uint64_t> shrinks from 48 to 40 bytes). A settled balance only
+* needs two bits, but insert and remove briefly store -2 and 2 before rotating, so
+* three bits are used.
 */
 template <typename Key, typename Value>
 class AVLNode : public Node<Key, Value>
@@ -21,7 +30,8 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(InsertSource<Key, Value>& source, AVLNode<Key, Value>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
@@ -29,14 +39,17 @@ public:
     void updateBalance(int8_t diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide (rather than
+    // override) the Node getters, so the AVL code gets them without a virtual
+    // call. See the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
+#ifndef AVL_COMPACT_NODES
     int8_t balance_;    // effectively a signed char
+#endif
 };
 
 /*
@@ -50,10 +63,34 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
+#ifdef AVL_COMPACT_NODES
+    Node<Key, Value>(key, value, parent)
+{
+    setBalance(0);
+}
+#else
     Node<Key, Value>(key, value, parent), balance_(0)
 {
 
 }
+#endif
+
+/**
+* A constructor that builds the item in place from an insert's source.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(InsertSource<Key, Value>& source, AVLNode<Key, Value> *parent) :
+#ifdef AVL_COMPACT_NODES
+    Node<Key, Value>(source, parent)
+{
+    setBalance(0);
+}
+#else
+    Node<Key, Value>(source, parent), balance_(0)
+{
+
+}
+#endif
 
 /**
 * A destructor which does nothing.
@@ -70,7 +107,12 @@ AVLNode<Key, Value>::~AVLNode()
 template<class Key, class Value>
 int8_t AVLNode<Key, Value>::getBalance() const
 {
+#ifdef AVL_COMPACT_NODES
+    // The tag holds balance + 2, so 0..4 maps back to -2..2
+    return static_cast<int8_t>(static_cast<int>(this->parent_ & this->TAG_MASK) - 2);
+#else
     return balance_;
+#endif
 }
 
 /**
@@ -79,7 +121,11 @@ int8_t AVLNode<Key, Value>::getBalance() const
 template<class Key, class Value>
 void AVLNode<Key, Value>::setBalance(int8_t balance)
 {
+#ifdef AVL_COMPACT_NODES
+    this->parent_ = (this->parent_ & ~this->TAG_MASK) | static_cast<std::uintptr_t>(balance + 2);
+#else
     balance_ = balance;
+#endif
 }
 
 /**
@@ -88,21 +134,21 @@ void AVLNode<Key, Value>::setBalance(int8_t balance)
 template<class Key, class Value>
 void AVLNode<Key, Value>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A redefined function for getting the parent since a static_cast is necessary to make sure
+* that our node is a AVLNode. The cast has no runtime cost.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +157,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -126,14 +172,216 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
   -----------------------------------------------
 */
 
+/**
+* Augmentation policies for AVLTree. A policy describes a value that every
+* node caches for its whole subtree: value_type, the identity() of an empty
+* subtree, lift() which gives the value of one key/value pair, and combine()
+* which joins the values of neighbouring ranges in key order (it has to be
+* associative, but need not be commutative). The tree keeps the cached values
+* right through inserts, removes and rotations, and AVLTree::query() combines
+* any key range in O(log n). Any type with these members can be used, the
+* ones below cover counts, sums, minimums and maximums.
+*
+* A value changed in place through an iterator or operator[] is not seen by
+* the cache, so in an augmented tree values should be updated with insert().
+*
+* NoAugment is the default and caches nothing, so it costs nothing.
+*/
+struct NoAugment
+{
+    typedef void value_type;
+};
+
+/**
+* Caches the number of nodes in every subtree, which gives AVLTree an
+* O(log n) select() and rank().
+*/
+struct SubtreeSize
+{
+    typedef std::size_t value_type;
+    static value_type identity() { return 0; }
+    template<typename Key, typename Value>
+    static value_type lift(const Key&, const Value&) { return 1; }
+    static value_type combine(value_type a, value_type b) { return a + b; }
+};
+
+/**
+* Caches the sum of the values in every subtree, as a T.
+*/
+template <typename T>
+struct SumAggregate
+{
+    typedef T value_type;
+    static value_type identity() { return T(); }
+    template<typename Key, typename Value>
+    static value_type lift(const Key&, const Value& value) { return value; }
+    static value_type combine(const value_type& a, const value_type& b) { return a + b; }
+};
+
+/**
+* Caches the smallest value in every subtree, as a T. An empty range
+* gives the largest T.
+*/
+template <typename T>
+struct MinAggregate
+{
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<T>::max(); }
+    template<typename Key, typename Value>
+    static value_type lift(const Key&, const Value& value) { return value; }
+    static value_type combine(const value_type& a, const value_type& b) { return std::min(a, b); }
+};
+
+/**
+* Caches the largest value in every subtree, as a T. An empty range
+* gives the lowest T.
+*/
+template <typename T>
+struct MaxAggregate
+{
+    typedef T value_type;
+    static value_type identity() { return std::numeric_limits<T>::lowest(); }
+    template<typename Key, typename Value>
+    static value_type lift(const Key&, const Value& value) { return value; }
+    static value_type combine(const value_type& a, const value_type& b) { return std::max(a, b); }
+};
+
+/**
+* An AVLNode with room for the cached value of an augmentation policy.
+*/
+template <typename Key, typename Value, typename Augment>
+class AugmentedAVLNode : public AVLNode<Key, Value>
+{
+public:
+    AugmentedAVLNode(InsertSource<Key, Value>& source, AVLNode<Key, Value>* parent);
+
+    const typename Augment::value_type& getAugment() const;
+    void setAugment(const typename Augment::value_type& augment);
+
+protected:
+    typename Augment::value_type augment_;
+};
+
+/**
+* An explicit constructor, the cached value starts out as that of a leaf.
+*/
+template<class Key, class Value, class Augment>
+AugmentedAVLNode<Key, Value, Augment>::AugmentedAVLNode(
+    InsertSource<Key, Value>& source, AVLNode<Key, Value>* parent) :
+    AVLNode<Key, Value>(source, parent),
+    augment_(Augment::lift(this->getKey(), this->getValue()))
+{
+
+}
+
+/**
+* A getter for the cached value of the node's subtree.
+*/
+template<class Key, class Value, class Augment>
+const typename Augment::value_type& AugmentedAVLNode<Key, Value, Augment>::getAugment() const
+{
+    return augment_;
+}
+
+/**
+* A setter for the cached value of the node's subtree.
+*/
+template<class Key, class Value, class Augment>
+void AugmentedAVLNode<Key, Value, Augment>::setAugment(const typename Augment::value_type& augment)
+{
+    augment_ = augment;
+}
+
+/**
+* Compile time glue between an AVLTree and its augmentation policy: the node
+* type the tree allocates, and how a node's cached value is recomputed from
+* its children. With NoAugment the tree uses plain AVLNodes and every hook
+* compiles away.
+*/
+template <typename Key, typename Value, typename Augment>
+struct AVLAugmentOps
+{
+    typedef AugmentedAVLNode<Key, Value, Augment> node_type;
+    typedef typename Augment::value_type value_type;
+    static const bool enabled = true;
+    static const bool destructNodes = !std::is_trivially_destructible<Key>::value ||
+                                      !std::is_trivially_destructible<Value>::value ||
+                                      !std::is_trivially_destructible<value_type>::value;
+
+    // The cached value of a subtree, an empty one has the identity
+    static value_type get(AVLNode<Key, Value>* node)
+    {
+      if (node == NULL) {
+        return Augment::identity();
+      }
+      return static_cast<node_type*>(node)->getAugment();
+    }
+
+    // Recomputes a node's value from its children, in key order
+    static void pull(AVLNode<Key, Value>* node)
+    {
+      value_type value = Augment::combine(get(node->getLeft()),
+                                          Augment::lift(node->getKey(), node->getValue()));
+      static_cast<node_type*>(node)->setAugment(Augment::combine(value, get(node->getRight())));
+    }
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+    static void swap(AVLNode<Key, Value>* n1, AVLNode<Key, Value>* n2)
+    {
+      value_type temp = get(n1);
+      static_cast<node_type*>(n1)->setAugment(get(n2));
+      static_cast<node_type*>(n2)->setAugment(temp);
+    }
+};
+
+template <typename Key, typename Value>
+struct AVLAugmentOps<Key, Value, NoAugment>
+{
+    typedef AVLNode<Key, Value> node_type;
+    static const bool enabled = false;
+    static const bool destructNodes = !std::is_trivially_destructible<Key>::value ||
+                                      !std::is_trivially_destructible<Value>::value;
+
+    static void pull(AVLNode<Key, Value>*) { }
+    static void swap(AVLNode<Key, Value>*, AVLNode<Key, Value>*) { }
+};
+
+
+template <class Key, class Value, class Augment = NoAugment, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
+    typedef typename BinarySearchTree<Key, Value, Compare>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::const_iterator const_iterator;
+
+    explicit AVLTree(const Compare& comp = Compare());
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); //DONE
     virtual void remove(const Key& key);  //DONE
+    // Keep the hinted insert from the BST visible next to ours
+    using BinarySearchTree<Key, Value, Compare>::insert;
+
+    // Bulk loading, both replace the current contents
+    template<typename ForwardIt>
+    void build(ForwardIt first, ForwardIt last);
+    template<typename ForwardIt>
+    void buildSorted(ForwardIt first, ForwardIt last);
+
+    // Order statistics, these need the SubtreeSize augmentation
+    iterator select(std::size_t k);
+    const_iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    // Combined augment value of the keys in [low, high)
+    typename Augment::value_type query(const Key& low, const Key& high) const;
+    // O(log n), read off the balance factors
+    virtual int height() const;
+    // Does nothing, an AVL tree is always balanced
+    virtual void rebalance();
 protected:
+    typedef AVLAugmentOps<Key, Value, Augment> AugmentOps;
+    typedef typename AugmentOps::node_type node_type;
+
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
     // Add helper functions here
@@ -142,6 +390,8 @@ protected:
     // rotation2 respectively
     void rotation1(AVLNode<Key, Value>* curr);
     void rotation2(AVLNode<Key, Value>* curr);
+    // This helper does the insert and rebalancing from a start node
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, InsertSource<Key, Value>& source);
     // This helper is to rebalance the tree after insert
     void insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* curr);
     // This helper is to rebalance the tree after remove
@@ -150,10 +400,156 @@ protected:
     AVLNode<Key, Value>* predecessor2(AVLNode<Key, Value>* curr);
     // This is the helper for internalFind
     AVLNode<Key, Value>* internalFind2(const Key& key);
+    // Finds the node for select(), or NULL
+    AVLNode<Key, Value>* selectNode(std::size_t k) const;
+    // This is the recursive helper for buildSorted
+    template<typename ForwardIt>
+    AVLNode<Key, Value>* buildHelper(ForwardIt& it, std::size_t count, AVLNode<Key, Value>* parent, int& height);
+    // Recomputes cached augment values from curr up to the root
+    void pullPath(AVLNode<Key, Value>* curr);
+    // Helpers for query that fold one side of a subtree
+    typename Augment::value_type foldFrom(AVLNode<Key, Value>* curr, const Key& low) const;
+    typename Augment::value_type foldBelow(AVLNode<Key, Value>* curr, const Key& high) const;
+    // Builds an AVLNode in a slot of the tree's node pool
+    AVLNode<Key, Value>* createNode(InsertSource<Key, Value>& source, AVLNode<Key, Value>* parent);
+    virtual void destructNode(Node<Key, Value>* node);
 
 
 };
 
+/**
+* Default constructor, which sizes the node pool for AVLNodes.
+*/
+template<class Key, class Value, class Augment, class Compare>
+AVLTree<Key, Value, Augment, Compare>::AVLTree(const Compare& comp) :
+  BinarySearchTree<Key, Value, Compare>(sizeof(node_type), alignof(node_type), AugmentOps::destructNodes, comp)
+{
+
+}
+
+/**
+* Destructor, which clears the tree while it is still an AVLTree so that
+* the nodes are destroyed as the node type they were built as.
+*/
+template<class Key, class Value, class Augment, class Compare>
+AVLTree<Key, Value, Augment, Compare>::~AVLTree()
+{
+  this->clear();
+}
+
+/**
+* Range constructor, which bulk loads the pairs in [first, last) with build().
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename ForwardIt>
+AVLTree<Key, Value, Augment, Compare>::AVLTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+  BinarySearchTree<Key, Value, Compare>(sizeof(node_type), alignof(node_type), AugmentOps::destructNodes, comp)
+{
+  build(first, last);
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last), which
+* may come in any order. If a key shows up more than once the last pair
+* wins, just like calling insert() for each pair would.
+* Input that is already sorted goes straight to buildSorted(), anything
+* else is copied and sorted first, so this is O(n) or O(n log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Augment, Compare>::build(ForwardIt first, ForwardIt last)
+{
+  // Check if the keys are already strictly increasing
+  bool sorted = true;
+  if (first != last)  {
+    ForwardIt prev = first;
+    for (ForwardIt it = std::next(first); it != last; ++it, ++prev) {
+      if (!this->comp_(prev->first, it->first)) {
+        sorted = false;
+        break;
+      }
+    }
+  }
+  if (sorted) {
+    buildSorted(first, last);
+    return;
+  }
+
+  // Otherwise sort a copy, the stable sort keeps equal keys in input
+  // order so that we can keep the last of each run
+  std::vector<std::pair<Key, Value> > items(first, last);
+  const Compare& comp = this->comp_;
+  std::stable_sort(items.begin(), items.end(),
+      [&comp](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+        return comp(a.first, b.first);
+      });
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < items.size(); i++) {
+    if (i + 1 < items.size() && !comp(items[i].first, items[i + 1].first)) {
+      continue;
+    }
+    if (kept != i) {
+      items[kept] = std::move(items[i]);
+    }
+    kept++;
+  }
+  items.resize(kept);
+  buildSorted(items.begin(), items.end());
+}
+
+/**
+* Replaces the contents of the tree with the pairs in [first, last), whose
+* keys must be strictly increasing. The tree is built bottom up with the
+* middle pair of every range as its subtree root, so it comes out height
+* balanced in O(n) with no searching or rotations.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename ForwardIt>
+void AVLTree<Key, Value, Augment, Compare>::buildSorted(ForwardIt first, ForwardIt last)
+{
+  this->clear();
+  std::size_t count = std::distance(first, last);
+  int height = 0;
+  this->root_ = buildHelper(first, count, NULL, height);
+}
+
+// Helper for buildSorted() that builds the next count pairs of the range
+// into a subtree. Pairs are consumed in order, so the left subtree is built
+// first, then the subtree root, then the right subtree. The right side gets
+// the extra pair when count is even, so its height is never smaller than the
+// left one and the balance is just the difference of the two.
+template<class Key, class Value, class Augment, class Compare>
+template<typename ForwardIt>
+AVLNode<Key, Value>* AVLTree<Key, Value, Augment, Compare>::buildHelper(
+    ForwardIt& it, std::size_t count, AVLNode<Key, Value>* parent, int& height)
+{
+  if (count == 0) {
+    height = 0;
+    return NULL;
+  }
+
+  std::size_t leftCount = (count - 1) / 2;
+  int leftHeight = 0;
+  int rightHeight = 0;
+  AVLNode<Key, Value>* left = buildHelper(it, leftCount, NULL, leftHeight);
+
+  CopyInsertSource<Key, Value> source(it->first, it->second);
+  AVLNode<Key, Value>* curr = createNode(source, parent);
+  ++it;
+  curr->setLeft(left);
+  if (left != NULL) {
+    left->setParent(curr);
+  }
+
+  AVLNode<Key, Value>* right = buildHelper(it, count - 1 - leftCount, curr, rightHeight);
+  curr->setRight(right);
+  curr->setBalance(rightHeight - leftHeight);
+  AugmentOps::pull(curr);
+
+  height = std::max(leftHeight, rightHeight) + 1;
+  return curr;
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
@@ -164,48 +560,74 @@ protected:
 // like a BST by traversing the tree and insert when
 // we can't traverse further. Then we update the value
 // and perform rotations
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::insert(const std::pair<const Key, Value> &new_item)
+{
+  // A plain insert searches from the root
+  CopyInsertSource<Key, Value> source(new_item.first, new_item.second);
+  insertFrom(this->root_, source);
+}
+
+// Helper that does the insert for insert() and the hinted inserts of the
+// BST, with the search starting at start instead of always at the root
+template<class Key, class Value, class Augment, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Augment, Compare>::insertFrom(
+    Node<Key, Value>* start, InsertSource<Key, Value>& source)
 {
   
   // It is crucial to check if the tree is empty as well, because
   // we need to assign the root a new node and then we are just done
   if (static_cast<AVLNode<Key, Value>*>(this->root_) == NULL)  {
-    this->root_ = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-    return;
+    this->root_ = createNode(source, NULL);
+    BST_STAT(this->countInsert(0, false, true);)
+    return this->root_;
   }
 
+  const Key& key = source.key();
   // First lets insert the new item by using the BST property
   // like how we did with the BST
   AVLNode<Key, Value>* parent = NULL;
-  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(static_cast<AVLNode<Key, Value>*>(this->root_));
+  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(start);
+  // The last node we went right at, which holds the key if it is
+  // already in the tree
+  AVLNode<Key, Value>* candidate = NULL;
+  bool goLeft = false;
   // As long as we are not at the bottom, traverse down to place
-  // the value 
+  // the value, one comparison per level
+  BST_STAT(std::uint64_t depth = 0;)
   while (curr != NULL)  {
+    BST_STAT(depth++;)
     parent = curr;
-    if (new_item.first < curr->getKey())  {
+    goLeft = this->comp_(key, curr->getKey());
+    if (goLeft)  {
       curr = curr->getLeft();
     }
-    else if (new_item.first > curr->getKey())  {
+    else  {
+      candidate = curr;
       curr = curr->getRight();
     }
-    else  {
-      curr->setValue(new_item.second);
-        return;
+  }
+  if (candidate != NULL && !this->comp_(candidate->getKey(), key))  {
+    BST_STAT(this->countInsert(depth, true, false);)
+    // The new value can change the cached values above it
+    if (source.update(candidate->getValue())) {
+      pullPath(candidate);
     }
+    return candidate;
   }
 
+  BST_STAT(this->countInsert(depth, candidate != NULL, true);)
   // Now we put the new item in this position
-  AVLNode<Key, Value>* add = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+  AVLNode<Key, Value>* add = createNode(source, parent);
   add->setBalance(0);
   // If the parent is the root (NULL), just add it to the root
   // Otherwise use the BST property again with the new parent position
   // to put the new value in the left or right spot
   if (parent == NULL) {
     this->root_ = add;
-    return;
+    return add;
   }
-  else if (new_item.first < parent->getKey()) {
+  else if (goLeft) {
     parent->setLeft(add);
   }
   else  {
@@ -221,7 +643,6 @@ void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
   // left rotation on the parent and then finally a left rotation
   if  (parent->getBalance() == -1 || parent->getBalance() == 1)  {
     parent->setBalance(0);
-    return;
   }
   else if (parent->getBalance() == 0) {
     if (add == parent->getLeft()) {
@@ -230,12 +651,17 @@ void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
     else  {
       parent->setBalance(1);
     }
+    BST_STAT(this->counters_.rebalances.add(1);)
     insertHelper(parent, add);
   }
+  // Every node on the way up from add now has one more node below it
+  pullPath(add);
+  // Rotations only move nodes around, so add still holds the new item
+  return add;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* curr)
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* curr)
 {
   if (parent == NULL) {
     return;
@@ -245,6 +671,7 @@ void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key,
   if (grand == NULL)  {
     return;
   }
+  BST_STAT(this->counters_.rebalanceSteps.add(1);)
 
   if (parent == grand->getLeft()) {
     grand->updateBalance(-1);
@@ -257,11 +684,13 @@ void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key,
     }
     else if (grand->getBalance() == -2) {
       if (curr == parent->getLeft())  {
+        BST_STAT(this->counters_.singleRotations.add(1);)
         rotation2(grand);
         parent->setBalance(0);
         grand->setBalance(0);
       }
       else  {
+        BST_STAT(this->counters_.doubleRotations.add(1);)
         rotation1(parent);
         rotation2(grand);
         if (curr->getBalance() == -1) {
@@ -293,6 +722,7 @@ void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key,
     }
     else if (grand->getBalance() == 2) {
       if (curr == parent->getLeft())  {
+        BST_STAT(this->counters_.doubleRotations.add(1);)
         rotation2(parent);
         rotation1(grand);
         if (curr->getBalance() == 1) {
@@ -310,6 +740,7 @@ void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key,
         curr->setBalance(0);
       }
       else  {
+        BST_STAT(this->counters_.singleRotations.add(1);)
         rotation1(grand);
         parent->setBalance(0);
         grand->setBalance(0);
@@ -321,8 +752,8 @@ void AVLTree<Key, Value>::insertHelper(AVLNode<Key, Value>* parent, AVLNode<Key,
 // Now lets impliment the helper functions for the insert function
 // Left rotation balance factors are greater than 1 because
 // insertion was in the right of the subtree
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotation1(AVLNode<Key, Value>* curr)  
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::rotation1(AVLNode<Key, Value>* curr)  
 {
   // We must save a node (the input) and fix its left, right, and parent node
   // in the left direction
@@ -355,13 +786,17 @@ void AVLTree<Key, Value>::rotation1(AVLNode<Key, Value>* curr)
     b->setParent(curr);
   }
 
+  // curr is now below fixNode, so it has to be recomputed first
+  AugmentOps::pull(curr);
+  AugmentOps::pull(fixNode);
+
 }
 
 // Same intuition as the left rotation, but the right rotation
 // balance factors are less than 1 because
 // insertion was in the left of the subtree
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotation2(AVLNode<Key, Value>* curr)  
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::rotation2(AVLNode<Key, Value>* curr)  
 {
 
   AVLNode<Key, Value>* fixNode = curr->getLeft();
@@ -390,6 +825,9 @@ void AVLTree<Key, Value>::rotation2(AVLNode<Key, Value>* curr)
   if  (b != NULL) {
     b->setParent(curr);
   }
+
+  AugmentOps::pull(curr);
+  AugmentOps::pull(fixNode);
   
 }
 
@@ -400,8 +838,8 @@ void AVLTree<Key, Value>::rotation2(AVLNode<Key, Value>* curr)
 // Remove function is similar to insert, but we must find the node
 // to remove and handle the same 3 cases as BST tree, and then 
 // traverse up to rebalance the tree
-template<class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key)  
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::remove(const Key& key)  
 {
   // We can use the helper function in the BST class to help us find
   // the node to remove
@@ -452,14 +890,16 @@ void AVLTree<Key, Value>::remove(const Key& key)
         } else {
             parent->setRight(child);
         }
-        delete target;
+        this->destroyNode(target);
+        BST_STAT(this->counters_.rebalances.add(1);)
         removeHelper(x, parent);
+        pullPath(parent);
   // Our fourth case involves no children
   // Check if the node is the root
     } else {
         // 
         if (parent == NULL) {
-            delete target;
+            this->destroyNode(target);
             this->root_ = NULL;
         } else {
             if (parent->getLeft() == target) {
@@ -469,20 +909,23 @@ void AVLTree<Key, Value>::remove(const Key& key)
                 parent->setRight(NULL);
                 x = -1;
             }
-            delete target;
+            this->destroyNode(target);
+            BST_STAT(this->counters_.rebalances.add(1);)
             removeHelper(x, parent);
+            pullPath(parent);
         }
     }
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::removeHelper(int num, AVLNode<Key, Value>* curr)
 {
   if (curr == NULL) {
     return;
   }
 
+  BST_STAT(this->counters_.rebalanceSteps.add(1);)
   AVLNode<Key, Value>* parent = curr->getParent();
   int num2 = 0;
 
@@ -502,12 +945,14 @@ void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
     int balance_left = left->getBalance();
 
     if (balance_left == -1) {
+      BST_STAT(this->counters_.singleRotations.add(1);)
       rotation2(curr);
       curr->setBalance(0);
       left->setBalance(0);
       removeHelper(num2, parent);
     }
     else if (balance_left == 0) {
+      BST_STAT(this->counters_.singleRotations.add(1);)
       rotation2(curr);
       curr->setBalance(-1);
       left->setBalance(1);
@@ -515,6 +960,7 @@ void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
     }
     else if (balance_left == 1) {
       AVLNode<Key, Value>* right = left->getRight();
+      BST_STAT(this->counters_.doubleRotations.add(1);)
       rotation1(left);
       rotation2(curr);
       
@@ -540,12 +986,14 @@ void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
     int balance_right = right->getBalance();
 
     if (balance_right == 1) {
+      BST_STAT(this->counters_.singleRotations.add(1);)
       rotation1(curr);
       curr->setBalance(0);
       right->setBalance(0);
       removeHelper(num2, parent);
     }
     else if (balance_right == 0) {
+      BST_STAT(this->counters_.singleRotations.add(1);)
       rotation1(curr);
       curr->setBalance(1);
       right->setBalance(-1);
@@ -553,6 +1001,7 @@ void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
     }
     else if (balance_right == -1) {
       AVLNode<Key, Value>* left = right->getLeft();
+      BST_STAT(this->counters_.doubleRotations.add(1);)
       rotation2(right);
       rotation1(curr);
       
@@ -586,33 +1035,15 @@ void AVLTree<Key, Value>::removeHelper(int num, AVLNode<Key, Value>* curr)
 
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::internalFind2(const Key& key) 
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Augment, Compare>::internalFind2(const Key& key) 
 {
-  // First store the node we are using and its parent
-  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
-
-  while (curr != NULL)  {
-
-    // Now traverse using the BST property
-    if (key < curr->getKey())  {
-      // Set it to the left node
-      curr = curr->getLeft();
-    }
-    else if (key > curr->getKey()) {
-      curr = curr->getRight();
-    }
-    else if (key == curr->getKey()) {
-      // Key already exists so return it as is
-      return curr;
-    }
-  }
-
-  return NULL;
+  // The BST search already makes one comparison per level
+  return static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::predecessor2(AVLNode<Key, Value>* curr)  
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Augment, Compare>::predecessor2(AVLNode<Key, Value>* curr)  
 {
     // First check if the node is null
   if (curr == NULL)  {
@@ -646,14 +1077,228 @@ AVLNode<Key, Value>* AVLTree<Key, Value>::predecessor2(AVLNode<Key, Value>* curr
   return NULL;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Augment, Compare>::createNode(
+    InsertSource<Key, Value>& source, AVLNode<Key, Value>* parent)
+{
+  void* slot = this->pool_.allocate();
+  try {
+    return new (slot) node_type(source, parent);
+  }
+  catch (...) {
+    this->pool_.deallocate(slot);
+    throw;
+  }
+}
+
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::destructNode(Node<Key, Value>* node)
+{
+  static_cast<node_type*>(node)->~node_type();
+}
+
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    // Cached values describe the position too, so they swap like the balance
+    AugmentOps::swap(n1, n2);
+}
+
+// Helper that walks from curr to the root recomputing cached values.
+// Rotations fix up the nodes they move, so after an insert or remove
+// only the ancestors of the changed spot are left to redo.
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::pullPath(AVLNode<Key, Value>* curr)
+{
+  if (!AugmentOps::enabled) {
+    return;
+  }
+  while (curr != NULL)  {
+    AugmentOps::pull(curr);
+    curr = curr->getParent();
+  }
+}
+
+/**
+* Returns the height of the tree, counting nodes. The balance of a node
+* says which child has the taller subtree, so following it down from the
+* root walks one longest path without looking at anything else.
+*/
+template<class Key, class Value, class Augment, class Compare>
+int AVLTree<Key, Value, Augment, Compare>::height() const
+{
+  int result = 0;
+  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+  while (curr != NULL) {
+    result++;
+    if (curr->getBalance() < 0) {
+      curr = curr->getLeft();
+    }
+    else {
+      curr = curr->getRight();
+    }
+  }
+  return result;
+}
+
+/**
+* An AVL tree never needs a rebuild, and its own insert and remove keep
+* it balanced, so auto rebalance has no effect on it either.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void AVLTree<Key, Value, Augment, Compare>::rebalance()
+{
+}
+
+/**
+* Returns an iterator to the item with the k-th smallest key (counting
+* from 0), or the end iterator if the tree holds k items or fewer.
+* Uses the subtree sizes to skip whole subtrees, so it is O(log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+typename AVLTree<Key, Value, Augment, Compare>::iterator
+AVLTree<Key, Value, Augment, Compare>::select(std::size_t k)
+{
+  return this->iteratorAt(selectNode(k));
+}
+
+/**
+* Returns a const_iterator to the item with the k-th smallest key, see above.
+*/
+template<class Key, class Value, class Augment, class Compare>
+typename AVLTree<Key, Value, Augment, Compare>::const_iterator
+AVLTree<Key, Value, Augment, Compare>::select(std::size_t k) const
+{
+  return this->iteratorAt(selectNode(k));
+}
+
+// Helper for select that skips whole subtrees by their sizes
+template<class Key, class Value, class Augment, class Compare>
+AVLNode<Key, Value>* AVLTree<Key, Value, Augment, Compare>::selectNode(std::size_t k) const
+{
+  static_assert(std::is_same<Augment, SubtreeSize>::value,
+                "select() needs an AVLTree<Key, Value, SubtreeSize>");
+  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+  while (curr != NULL)  {
+    std::size_t leftSize = AugmentOps::get(curr->getLeft());
+    if (k < leftSize) {
+      curr = curr->getLeft();
+    }
+    else if (k == leftSize) {
+      break;
+    }
+    else  {
+      k -= leftSize + 1;
+      curr = curr->getRight();
+    }
+  }
+  return curr;
+}
+
+/**
+* Returns how many keys in the tree are less than key, in O(log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+std::size_t AVLTree<Key, Value, Augment, Compare>::rank(const Key& key) const
+{
+  static_assert(std::is_same<Augment, SubtreeSize>::value,
+                "rank() needs an AVLTree<Key, Value, SubtreeSize>");
+  std::size_t count = 0;
+  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+  while (curr != NULL)  {
+    if (this->comp_(curr->getKey(), key)) {
+      // Everything on the left and curr itself are smaller
+      count += AugmentOps::get(curr->getLeft()) + 1;
+      curr = curr->getRight();
+    }
+    else  {
+      curr = curr->getLeft();
+    }
+  }
+  return count;
+}
+
+
+/**
+* Returns the augment values of every item with a key in [low, high)
+* combined in key order, or the identity if there are none. Whole subtrees
+* inside the range are taken from their cached value, so only the two
+* paths to the ends of the range are walked and this is O(log n).
+*/
+template<class Key, class Value, class Augment, class Compare>
+typename Augment::value_type
+AVLTree<Key, Value, Augment, Compare>::query(const Key& low, const Key& high) const
+{
+  static_assert(AugmentOps::enabled, "query() needs an augmented AVLTree");
+  // Go down to the first node inside the range, the paths to
+  // the two ends of the range split there
+  AVLNode<Key, Value>* curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+  while (curr != NULL)  {
+    if (this->comp_(curr->getKey(), low)) {
+      curr = curr->getRight();
+    }
+    else if (!this->comp_(curr->getKey(), high)) {
+      curr = curr->getLeft();
+    }
+    else  {
+      break;
+    }
+  }
+  if (curr == NULL) {
+    return Augment::identity();
+  }
+
+  typename Augment::value_type result =
+      Augment::combine(foldFrom(curr->getLeft(), low), Augment::lift(curr->getKey(), curr->getValue()));
+  return Augment::combine(result, foldBelow(curr->getRight(), high));
+}
+
+// Helper for query that combines the keys of a subtree that are not less
+// than low. Whenever curr is in range so is its right subtree, and those
+// come after anything still to be found on the left.
+template<class Key, class Value, class Augment, class Compare>
+typename Augment::value_type
+AVLTree<Key, Value, Augment, Compare>::foldFrom(AVLNode<Key, Value>* curr, const Key& low) const
+{
+  typename Augment::value_type result = Augment::identity();
+  while (curr != NULL)  {
+    if (this->comp_(curr->getKey(), low)) {
+      curr = curr->getRight();
+    }
+    else  {
+      typename Augment::value_type right =
+          Augment::combine(Augment::lift(curr->getKey(), curr->getValue()), AugmentOps::get(curr->getRight()));
+      result = Augment::combine(right, result);
+      curr = curr->getLeft();
+    }
+  }
+  return result;
+}
+
+// Helper for query that combines the keys of a subtree that are less than
+// high, the mirror image of foldFrom
+template<class Key, class Value, class Augment, class Compare>
+typename Augment::value_type
+AVLTree<Key, Value, Augment, Compare>::foldBelow(AVLNode<Key, Value>* curr, const Key& high) const
+{
+  typename Augment::value_type result = Augment::identity();
+  while (curr != NULL)  {
+    if (this->comp_(curr->getKey(), high)) {
+      typename Augment::value_type left =
+          Augment::combine(AugmentOps::get(curr->getLeft()), Augment::lift(curr->getKey(), curr->getValue()));
+      result = Augment::combine(result, left);
+      curr = curr->getRight();
+    }
+    else  {
+      curr = curr->getLeft();
+    }
+  }
+  return result;
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,593 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <string_view>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+#include "frozen_bst.h"
+
+using namespace std;
+
+// Keeps the optimizer from throwing away lookups whose result is unused
+static volatile uint64_t sink;
+
+// Returns the nanoseconds per operation of running f over ops operations
+template<typename F>
+double timeOps(size_t ops, F f)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  f();
+  chrono::steady_clock::time_point stop = chrono::steady_clock::now();
+  return chrono::duration<double, nano>(stop - start).count() / ops;
+}
+
+void report(const string& tree, const string& op, size_t n, double nsPerOp)
+{
+  cout << tree << " " << op << " n=" << n << ": " << nsPerOp << " ns/op" << endl;
+}
+
+// Times random inserts followed by successful finds on one kind of tree
+template<typename Tree>
+void benchInsertFind(const string& name, const vector<uint64_t>& keys)
+{
+  Tree tree;
+  double insertNs = timeOps(keys.size(), [&]() {
+    for (size_t i = 0; i < keys.size(); i++) {
+      tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+  });
+  report(name, "insert", keys.size(), insertNs);
+
+  double findNs = timeOps(keys.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      total += tree.find(keys[i])->second;
+    }
+    sink = total;
+  });
+  report(name, "find", keys.size(), findNs);
+}
+
+// Times a full in-order walk with the parent-climbing iterator against
+// the stack-based scan iterator
+template<typename Tree>
+void benchScan(const string& name, const vector<uint64_t>& keys)
+{
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); i++) {
+    tree.insert(make_pair(keys[i], keys[i]));
+  }
+
+  double iterNs = timeOps(keys.size(), [&]() {
+    uint64_t total = 0;
+    for (typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+      total += it->second;
+    }
+    sink = total;
+  });
+  report(name, "iterator scan", keys.size(), iterNs);
+
+  double scanNs = timeOps(keys.size(), [&]() {
+    uint64_t total = 0;
+    for (typename Tree::scan_iterator it = tree.scanBegin(); it != tree.scanEnd(); ++it) {
+      total += it->second;
+    }
+    sink = total;
+  });
+  report(name, "scan_iterator scan", keys.size(), scanNs);
+}
+
+// A big value that counts how often it is deep copied
+struct Payload
+{
+  static size_t copies;
+  string text;
+  Payload() { }
+  explicit Payload(const string& t) : text(t) { }
+  Payload(const Payload& other) : text(other.text) { copies++; }
+  Payload(Payload&& other) : text(std::move(other.text)) { }
+  Payload& operator=(const Payload& other) { text = other.text; copies++; return *this; }
+  Payload& operator=(Payload&& other) { text = std::move(other.text); return *this; }
+};
+size_t Payload::copies = 0;
+
+ostream& operator<<(ostream& out, const Payload& payload)
+{
+  return out << payload.text;
+}
+
+// Times string-keyed inserts of a big value through the copying insert,
+// the moving insert and try_emplace, and counts the deep copies of values
+template<typename Tree>
+void benchEmplace(const string& name, const vector<uint64_t>& keys)
+{
+  size_t n = keys.size();
+  vector<string> names(n);
+  for (size_t i = 0; i < n; i++) {
+    names[i] = "key-" + to_string(keys[i]);
+  }
+  const string text(200, 'x');
+
+  Payload::copies = 0;
+  double copyNs = timeOps(n, [&]() {
+    Tree tree;
+    for (size_t i = 0; i < n; i++) {
+      pair<const string, Payload> item(names[i], Payload(text));
+      tree.insert(item);
+    }
+  });
+  cout << name << " insert(const pair&) n=" << n << ": " << copyNs << " ns/op, "
+       << double(Payload::copies) / n << " value copies/op" << endl;
+
+  Payload::copies = 0;
+  double moveNs = timeOps(n, [&]() {
+    Tree tree;
+    for (size_t i = 0; i < n; i++) {
+      tree.insert(make_pair(names[i], Payload(text)));
+    }
+  });
+  cout << name << " insert(pair&&) n=" << n << ": " << moveNs << " ns/op, "
+       << double(Payload::copies) / n << " value copies/op" << endl;
+
+  Payload::copies = 0;
+  double emplaceNs = timeOps(n, [&]() {
+    Tree tree;
+    for (size_t i = 0; i < n; i++) {
+      tree.try_emplace(names[i], text);
+    }
+  });
+  cout << name << " try_emplace n=" << n << ": " << emplaceNs << " ns/op, "
+       << double(Payload::copies) / n << " value copies/op" << endl;
+}
+
+// Times string-keyed lookups given as string_views: the default
+// comparator needs a std::string built per lookup, std::less<> compares
+// the view against the stored keys directly
+void benchTransparent(const vector<uint64_t>& keys)
+{
+  size_t n = keys.size();
+  vector<string> names(n);
+  for (size_t i = 0; i < n; i++) {
+    // Long enough that building a std::string has to allocate
+    names[i] = "transparent-lookup-key-" + to_string(keys[i]);
+  }
+  vector<string_view> views(names.begin(), names.end());
+
+  AVLTree<string, uint64_t> byString;
+  AVLTree<string, uint64_t, NoAugment, less<> > byView;
+  for (size_t i = 0; i < n; i++) {
+    byString.insert(make_pair(names[i], keys[i]));
+    byView.insert(make_pair(names[i], keys[i]));
+  }
+
+  double stringNs = timeOps(n, [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+      total += byString.find(string(views[i]))->second;
+    }
+    sink = total;
+  });
+  report("AVLTree", "find(string(view))", n, stringNs);
+
+  double viewNs = timeOps(n, [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+      total += byView.find(views[i])->second;
+    }
+    sink = total;
+  });
+  report("AVLTree", "find(view) with less<>", n, viewNs);
+}
+
+// Times loading sorted pairs into an AVLTree one insert at a time
+// against a single bulk build
+void benchBuild(size_t n)
+{
+  vector<pair<uint64_t, uint64_t> > items(n);
+  for (size_t i = 0; i < n; i++) {
+    items[i] = make_pair(i, i);
+  }
+
+  double insertNs = timeOps(n, [&]() {
+    AVLTree<uint64_t, uint64_t> tree;
+    for (size_t i = 0; i < n; i++) {
+      tree.insert(items[i]);
+    }
+  });
+  report("AVLTree", "sorted insert loop", n, insertNs);
+
+  double buildNs = timeOps(n, [&]() {
+    AVLTree<uint64_t, uint64_t> tree;
+    tree.buildSorted(items.begin(), items.end());
+  });
+  report("AVLTree", "buildSorted", n, buildNs);
+}
+
+// Times a batch of mostly sorted pairs going in through insertBatch
+// against the same pairs inserted one by one
+template<typename Tree>
+void benchBatch(const string& name, size_t n)
+{
+  // Sorted keys where every 16th one is swapped with a random neighbor
+  mt19937_64 rng(7);
+  vector<pair<uint64_t, uint64_t> > items(n);
+  for (size_t i = 0; i < n; i++) {
+    items[i] = make_pair(i, i);
+  }
+  for (size_t i = 0; i + 8 < n; i += 16) {
+    swap(items[i], items[i + rng() % 8]);
+  }
+
+  double loopNs = timeOps(n, [&]() {
+    Tree tree;
+    for (size_t i = 0; i < n; i++) {
+      tree.insert(items[i]);
+    }
+  });
+  report(name, "nearly sorted insert loop", n, loopNs);
+
+  double batchNs = timeOps(n, [&]() {
+    Tree tree;
+    tree.insertBatch(items.begin(), items.end());
+  });
+  report(name, "nearly sorted insertBatch", n, batchNs);
+}
+
+// A BinarySearchTree that can be grown into a right-leaning chain in
+// O(1) per key, the shape sorted inserts give without the O(n^2) cost
+class ChainTree : public BinarySearchTree<uint64_t, string>
+{
+public:
+  void buildChain(size_t n, const string& value)
+  {
+    Node<uint64_t, string>* last = NULL;
+    for (size_t i = 0; i < n; i++) {
+      CopyInsertSource<uint64_t, string> source(i, value);
+      // The last key is the largest, so its empty right subtree is
+      // where the next one goes
+      last = insertFrom(last, source);
+    }
+  }
+};
+
+// Times clear() on a balanced tree and on a chain of the same size; the
+// string values make clear() walk the nodes to run their destructors
+void benchClear(const vector<uint64_t>& keys)
+{
+  size_t n = keys.size();
+  const string value(32, 'x');
+
+  double balancedNs = 0;
+  {
+    BinarySearchTree<uint64_t, string> tree;
+    for (size_t i = 0; i < n; i++) {
+      tree.insert(make_pair(keys[i], value));
+    }
+    balancedNs = timeOps(n, [&]() { tree.clear(); });
+  }
+  report("BinarySearchTree", "clear balanced", n, balancedNs);
+
+  double chainNs = 0;
+  {
+    ChainTree tree;
+    tree.buildChain(n, value);
+    chainNs = timeOps(n, [&]() { tree.clear(); });
+  }
+  report("BinarySearchTree", "clear chain", n, chainNs);
+}
+
+// Times the isBalanced() health check and height() on a balanced tree
+// and on a chain, where the check can give up after a few levels
+void benchHealth(const vector<uint64_t>& keys)
+{
+  size_t n = keys.size();
+  const string value(32, 'x');
+  AVLTree<uint64_t, string> tree;
+  for (size_t i = 0; i < n; i++) {
+    tree.insert(make_pair(keys[i], value));
+  }
+  ChainTree chain;
+  chain.buildChain(n, value);
+  const BinarySearchTree<uint64_t, string>& base = tree;
+
+  report("AVLTree", "isBalanced", n, timeOps(n, [&]() { sink = tree.isBalanced(); }));
+  report("BinarySearchTree", "isBalanced chain", n, timeOps(n, [&]() { sink = chain.isBalanced(); }));
+  report("AVLTree", "height", n, timeOps(n, [&]() { sink = tree.height(); }));
+  report("BinarySearchTree", "height (same tree)", n,
+         timeOps(n, [&]() { sink = base.BinarySearchTree<uint64_t, string>::height(); }));
+}
+
+// Times rebalance() on a chain, and sorted inserts into a BST with the
+// scapegoat style auto rebalance against an AVLTree
+void benchRebalance(size_t n)
+{
+  const string value(32, 'x');
+  ChainTree chain;
+  chain.buildChain(n, value);
+  report("BinarySearchTree", "rebalance chain", n, timeOps(n, [&]() { chain.rebalance(); }));
+  cout << "BinarySearchTree height after rebalance n=" << n << ": " << chain.height() << endl;
+
+  for (double alpha = 0.6; alpha < 0.95; alpha += 0.15) {
+    BinarySearchTree<uint64_t, uint64_t> tree;
+    tree.setAutoRebalance(alpha);
+    double ns = timeOps(n, [&]() {
+      for (size_t i = 0; i < n; i++) {
+        tree.insert(make_pair(i, i));
+      }
+    });
+    cout << "BinarySearchTree sorted insert alpha=" << alpha << " n=" << n << ": " << ns
+         << " ns/op, height " << tree.height() << endl;
+  }
+
+  AVLTree<uint64_t, uint64_t> avl;
+  double avlNs = timeOps(n, [&]() {
+    for (size_t i = 0; i < n; i++) {
+      avl.insert(make_pair(i, i));
+    }
+  });
+  cout << "AVLTree sorted insert n=" << n << ": " << avlNs << " ns/op, height " << avl.height() << endl;
+}
+
+// Times random finds on an AVLTree against the same keys frozen into
+// the van Emde Boas layout
+void benchFrozen(const vector<uint64_t>& keys)
+{
+  AVLTree<uint64_t, uint64_t> tree;
+  for (size_t i = 0; i < keys.size(); i++) {
+    tree.insert(make_pair(keys[i], keys[i]));
+  }
+  // FrozenTree<uint64_t, ...> is an EytzingerTree, benchEytzinger times that
+  double freezeNs = 0;
+  VebTree<uint64_t, uint64_t> frozen;
+  freezeNs = timeOps(keys.size(), [&]() { frozen = VebTree<uint64_t, uint64_t>(tree); });
+  report("VebTree", "freeze", keys.size(), freezeNs);
+
+  // Look the keys up in a different order than they went in
+  vector<uint64_t> probes(keys);
+  shuffle(probes.begin(), probes.end(), mt19937_64(5));
+  double treeNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+      total += tree.find(probes[i])->second;
+    }
+    sink = total;
+  });
+  report("AVLTree", "find", probes.size(), treeNs);
+
+  double frozenNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+      total += frozen.find(probes[i])->second;
+    }
+    sink = total;
+  });
+  report("VebTree", "find", probes.size(), frozenNs);
+}
+
+// Times the Eytzinger snapshot of an integer keyed AVLTree, one find at a
+// time and the whole batch through find_many, against AVLTree::find
+template<typename Key>
+void benchEytzinger(const string& name, const vector<uint64_t>& keys)
+{
+  AVLTree<Key, uint64_t> tree;
+  vector<Key> probes(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    probes[i] = static_cast<Key>(keys[i]);
+    tree.insert(make_pair(probes[i], keys[i]));
+  }
+  shuffle(probes.begin(), probes.end(), mt19937_64(5));
+
+  FrozenTree<Key, uint64_t> frozen;
+  double freezeNs = timeOps(keys.size(), [&]() { frozen = freeze(tree); });
+  report("FrozenTree<" + name + ">", "freeze", keys.size(), freezeNs);
+
+  double treeNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+      total += tree.find(probes[i])->second;
+    }
+    sink = total;
+  });
+  report("AVLTree<" + name + ">", "find", probes.size(), treeNs);
+
+  double findNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+      total += frozen.find(probes[i])->second;
+    }
+    sink = total;
+  });
+  report("FrozenTree<" + name + ">", "find", probes.size(), findNs);
+
+  vector<typename FrozenTree<Key, uint64_t>::const_iterator> found(probes.size());
+  double manyNs = timeOps(probes.size(), [&]() {
+    frozen.find_many(probes.begin(), probes.end(), found.begin());
+    uint64_t total = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+      total += found[i]->second;
+    }
+    sink = total;
+  });
+  report("FrozenTree<" + name + ">", "find_many", probes.size(), manyNs);
+}
+
+// Times lookups of the keys in batches of 256, the way a request handler
+// sees them, one find at a time and then a find_many per batch
+template<typename Tree>
+void benchFindMany(const string& name, const vector<uint64_t>& keys)
+{
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); i++) {
+    tree.insert(make_pair(keys[i], keys[i]));
+  }
+  const size_t batch = 256;
+  vector<uint64_t> probes(keys);
+  shuffle(probes.begin(), probes.end(), mt19937_64(6));
+
+  double findNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i++) {
+      total += tree.find(probes[i])->second;
+    }
+    sink = total;
+  });
+  report(name, "find", probes.size(), findNs);
+
+  vector<typename Tree::iterator> found(batch);
+  double manyNs = timeOps(probes.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < probes.size(); i += batch) {
+      size_t count = min(batch, probes.size() - i);
+      tree.find_many(probes.begin() + i, probes.begin() + i + count, found.begin());
+      for (size_t j = 0; j < count; j++) {
+        total += found[j]->second;
+      }
+    }
+    sink = total;
+  });
+  report(name, "find_many x256", probes.size(), manyNs);
+}
+
+// An AVLTree behind one plain mutex, the setup ConcurrentAVLTree replaces
+class MutexAVLTree
+{
+public:
+  void insert(const pair<const uint64_t, uint64_t>& item)
+  {
+    lock_guard<mutex> guard(lock_);
+    tree_.insert(item);
+  }
+  bool find(uint64_t key, uint64_t& value) const
+  {
+    lock_guard<mutex> guard(lock_);
+    AVLTree<uint64_t, uint64_t>::const_iterator it = tree_.find(key);
+    if (it == tree_.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+private:
+  AVLTree<uint64_t, uint64_t> tree_;
+  mutable mutex lock_;
+};
+
+// Times lookups spread over 1, 2, 4, ... threads up to the core count and
+// reports the total throughput, so read scaling shows up directly
+template<typename Tree>
+void benchReaders(const string& name, const vector<uint64_t>& keys)
+{
+  Tree tree;
+  for (size_t i = 0; i < keys.size(); i++) {
+    tree.insert(make_pair(keys[i], keys[i]));
+  }
+
+  unsigned cores = max(1u, thread::hardware_concurrency());
+  for (unsigned threads = 1; threads <= cores; threads *= 2) {
+    size_t perThread = keys.size();
+    double ns = timeOps(perThread * threads, [&]() {
+      vector<thread> readers;
+      for (unsigned t = 0; t < threads; t++) {
+        readers.push_back(thread([&, t]() {
+          uint64_t total = 0;
+          uint64_t value = 0;
+          for (size_t i = 0; i < perThread; i++) {
+            if (tree.find(keys[(i + t * 7919) % keys.size()], value)) {
+              total += value;
+            }
+          }
+          sink = total;
+        }));
+      }
+      for (unsigned t = 0; t < threads; t++) {
+        readers[t].join();
+      }
+    });
+    cout << name << " find threads=" << threads << ": " << 1000.0 / ns << " Mops/s" << endl;
+  }
+}
+
+// Times the copy-on-write tree: inserts pay for copying their path, a
+// snapshot is one atomic load of the root, and finds on it take no lock
+void benchPersistent(const vector<uint64_t>& keys)
+{
+  PersistentAVLTree<uint64_t, uint64_t> tree;
+  double insertNs = timeOps(keys.size(), [&]() {
+    for (size_t i = 0; i < keys.size(); i++) {
+      tree.insert(make_pair(keys[i], keys[i]));
+    }
+  });
+  report("PersistentAVLTree", "insert", keys.size(), insertNs);
+
+  const size_t snapshots = 100000;
+  double snapshotNs = timeOps(snapshots, [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < snapshots; i++) {
+      total += tree.snapshot().height();
+    }
+    sink = total;
+  });
+  report("PersistentAVLTree", "snapshot", snapshots, snapshotNs);
+
+  PersistentAVLTree<uint64_t, uint64_t> version = tree.snapshot();
+  double findNs = timeOps(keys.size(), [&]() {
+    uint64_t total = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      total += version.find(keys[i])->second;
+    }
+    sink = total;
+  });
+  report("PersistentAVLTree", "find on snapshot", keys.size(), findNs);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t n = 1000000;
+  if (argc > 1) {
+    n = strtoul(argv[1], NULL, 10);
+  }
+
+  // Random keys keep the plain BST at O(log n) depth too
+  mt19937_64 rng(104);
+  vector<uint64_t> keys(n);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = rng();
+  }
+
+  cout << "sizeof(Node<uint64_t,uint64_t>) = " << sizeof(Node<uint64_t, uint64_t>) << endl;
+  cout << "sizeof(AVLNode<uint64_t,uint64_t>) = " << sizeof(AVLNode<uint64_t, uint64_t>) << endl;
+
+  benchInsertFind<BinarySearchTree<uint64_t, uint64_t> >("BinarySearchTree", keys);
+  benchInsertFind<AVLTree<uint64_t, uint64_t> >("AVLTree", keys);
+  benchScan<BinarySearchTree<uint64_t, uint64_t> >("BinarySearchTree", keys);
+  benchScan<AVLTree<uint64_t, uint64_t> >("AVLTree", keys);
+  benchEmplace<BinarySearchTree<string, Payload> >("BinarySearchTree", keys);
+  benchEmplace<AVLTree<string, Payload> >("AVLTree", keys);
+  benchTransparent(keys);
+  benchClear(keys);
+  benchHealth(keys);
+  benchRebalance(n);
+  benchBuild(n);
+  benchFindMany<BinarySearchTree<uint64_t, uint64_t> >("BinarySearchTree", keys);
+  benchFindMany<AVLTree<uint64_t, uint64_t> >("AVLTree", keys);
+  // The plain BST degenerates on sorted input, so keep it small
+  benchBatch<BinarySearchTree<uint64_t, uint64_t> >("BinarySearchTree", min<size_t>(n, 20000));
+  benchBatch<AVLTree<uint64_t, uint64_t> >("AVLTree", n);
+  benchReaders<MutexAVLTree>("AVLTree+mutex", keys);
+  benchReaders<ConcurrentAVLTree<uint64_t, uint64_t> >("ConcurrentAVLTree", keys);
+  benchPersistent(keys);
+  benchFrozen(keys);
+  benchEytzinger<uint64_t>("uint64_t", keys);
+  benchEytzinger<int32_t>("int32_t", keys);
+
+  return 0;
+}
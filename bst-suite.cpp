@@ -0,0 +1,242 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+// Runs every operation on every tree for every key distribution and
+// size, and prints the results as JSON in the layout Google Benchmark
+// uses, so they can be kept and compared from release to release.
+// ./bst-suite [max n], sizes go up by 10x from 1000
+
+// Keeps the optimizer from throwing away lookups whose result is unused
+static volatile uint64_t sink;
+
+// Sequential keys make the plain BST a chain, O(n^2) to build, so it
+// only gets that distribution up to this size
+static const size_t BST_SEQUENTIAL_MAX = 20000;
+
+// Every measurement is repeated until it covers at least this many
+// operations, so small sizes are not just timer noise
+static const size_t MIN_OPS = 1000000;
+
+typedef chrono::steady_clock Clock;
+
+double elapsedNs(Clock::time_point start)
+{
+  return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+// The keys a measurement inserts, then looks up, then removes. Every
+// distribution inserts n distinct keys, so the tree always ends up with
+// n nodes and the rows compare across distributions
+struct Workload
+{
+  vector<uint64_t> inserts;
+  vector<uint64_t> finds;
+  vector<uint64_t> removes;
+};
+
+// Rank r (from 0) is the r-th most popular key. Multiplying by an odd
+// constant is one to one, so ranks stay distinct, and it scatters them
+// over the key space so the hot keys are not also neighbors
+uint64_t zipfKey(size_t rank)
+{
+  return (rank + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+// The n keys inserted in random order. Lookups draw ranks from a Zipf
+// distribution with exponent 1, so a few keys come up very often, and
+// removes take every key once, the most popular first
+Workload zipfWorkload(size_t n, mt19937_64& rng)
+{
+  Workload load;
+  for (size_t i = 0; i < n; i++) {
+    load.removes.push_back(zipfKey(i));
+  }
+  load.inserts = load.removes;
+  shuffle(load.inserts.begin(), load.inserts.end(), rng);
+
+  vector<double> cdf(n);
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += 1.0 / (i + 1);
+    cdf[i] = total;
+  }
+  uniform_real_distribution<double> uniform(0, total);
+  load.finds.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+    load.finds[i] = zipfKey(min(rank, n - 1));
+  }
+  return load;
+}
+
+Workload makeWorkload(const string& distribution, size_t n)
+{
+  mt19937_64 rng(104);
+  if (distribution == "zipf") {
+    return zipfWorkload(n, rng);
+  }
+  Workload load;
+  load.inserts.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    load.inserts[i] = distribution == "sequential" ? i : rng();
+  }
+  // 64 bit random keys almost never repeat, but make sure of it
+  vector<uint64_t> sorted(load.inserts);
+  sort(sorted.begin(), sorted.end());
+  if (adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+    load.inserts.assign(sorted.begin(), unique(sorted.begin(), sorted.end()));
+    shuffle(load.inserts.begin(), load.inserts.end(), rng);
+  }
+  load.finds = load.inserts;
+  load.removes = load.inserts;
+  return load;
+}
+
+// The trees and std::map differ only in how a key is removed
+template<typename Tree>
+void removeKey(Tree& tree, uint64_t key)
+{
+  tree.remove(key);
+}
+
+void removeKey(map<uint64_t, uint64_t>& tree, uint64_t key)
+{
+  tree.erase(key);
+}
+
+template<typename Tree>
+void fill(Tree& tree, const vector<uint64_t>& keys)
+{
+  for (size_t i = 0; i < keys.size(); i++) {
+    tree.insert(make_pair(keys[i], keys[i]));
+  }
+}
+
+struct Result
+{
+  string op;
+  size_t iterations;
+  double ns;
+};
+
+// Times insert, find, iteration, remove and clear on one tree type,
+// each as ns per key (per item for iteration)
+template<typename Tree>
+vector<Result> measure(const Workload& load)
+{
+  size_t n = load.inserts.size();
+  size_t reps = max<size_t>(1, MIN_OPS / n);
+  double insertNs = 0, findNs = 0, iterateNs = 0, removeNs = 0, clearNs = 0;
+  size_t items = 0;
+
+  for (size_t r = 0; r < reps; r++) {
+    Tree tree;
+    Clock::time_point start = Clock::now();
+    fill(tree, load.inserts);
+    insertNs += elapsedNs(start);
+
+    start = Clock::now();
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+      total += tree.find(load.finds[i])->second;
+    }
+    sink = total;
+    findNs += elapsedNs(start);
+
+    start = Clock::now();
+    total = 0;
+    for (typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it) {
+      total += it->second;
+      items++;
+    }
+    sink = total;
+    iterateNs += elapsedNs(start);
+
+    start = Clock::now();
+    for (size_t i = 0; i < n; i++) {
+      removeKey(tree, load.removes[i]);
+    }
+    removeNs += elapsedNs(start);
+
+    fill(tree, load.inserts);
+    start = Clock::now();
+    tree.clear();
+    clearNs += elapsedNs(start);
+  }
+
+  size_t ops = reps * n;
+  vector<Result> results;
+  Result insert = { "insert", ops, insertNs / ops };
+  Result find = { "find", ops, findNs / ops };
+  Result iterate = { "iterate", items, iterateNs / max<size_t>(items, 1) };
+  Result remove = { "remove", ops, removeNs / ops };
+  Result clear = { "clear", ops, clearNs / ops };
+  results.push_back(insert);
+  results.push_back(find);
+  results.push_back(iterate);
+  results.push_back(remove);
+  results.push_back(clear);
+  return results;
+}
+
+void print(bool& first, const string& tree, const string& distribution, size_t n,
+           const vector<Result>& results)
+{
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result& result = results[i];
+    cout << (first ? "\n" : ",\n");
+    first = false;
+    cout << "    {\"name\": \"" << tree << "/" << result.op << "/" << distribution << "/" << n << "\", "
+         << "\"tree\": \"" << tree << "\", \"op\": \"" << result.op << "\", "
+         << "\"keys\": \"" << distribution << "\", \"n\": " << n << ", "
+         << "\"iterations\": " << result.iterations << ", "
+         << "\"real_time\": " << result.ns << ", \"time_unit\": \"ns\"}";
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  size_t maxN = 1000000;
+  if (argc > 1) {
+    maxN = strtoul(argv[1], NULL, 10);
+  }
+
+  cout << "{\n  \"context\": {\"compiler\": \"" << __VERSION__ << "\", "
+       << "\"sizeof_node\": " << sizeof(Node<uint64_t, uint64_t>) << ", "
+       << "\"sizeof_avl_node\": " << sizeof(AVLNode<uint64_t, uint64_t>) << "},\n"
+       << "  \"benchmarks\": [";
+
+  const char* distributions[] = { "sequential", "random", "zipf" };
+  bool first = true;
+  for (size_t n = 1000; n <= maxN; n *= 10) {
+    for (size_t d = 0; d < 3; d++) {
+      string distribution = distributions[d];
+      Workload load = makeWorkload(distribution, n);
+      // The size of the tree, n unless random keys repeated
+      size_t size = load.inserts.size();
+      if (distribution != "sequential" || n <= BST_SEQUENTIAL_MAX) {
+        print(first, "BinarySearchTree", distribution, size,
+              measure<BinarySearchTree<uint64_t, uint64_t> >(load));
+      }
+      print(first, "AVLTree", distribution, size, measure<AVLTree<uint64_t, uint64_t> >(load));
+      print(first, "std::map", distribution, size, measure<map<uint64_t, uint64_t> >(load));
+      // Progress goes to stderr so stdout stays valid JSON
+      cerr << "done n=" << n << " " << distribution << endl;
+    }
+  }
+  cout << "\n  ]\n}" << endl;
+
+  return 0;
+}
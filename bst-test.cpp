@@ -25,6 +25,35 @@ int main(int argc, char *argv[])
     }
     cout << "Erasing b" << endl;
     bt.remove('b');
+
+    // Range queries
+    bt.insert(std::make_pair('c',3));
+    bt.insert(std::make_pair('d',4));
+    cout << "Keys in [b, d):" << endl;
+    BinarySearchTree<char,int>::range_view window = bt.range('b', 'd');
+    for(BinarySearchTree<char,int>::iterator it = window.begin(); it != window.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Descending order, e.g. the latest two keys
+    cout << "Largest two keys:" << endl;
+    int shown = 0;
+    for(BinarySearchTree<char,int>::reverse_iterator it = bt.rbegin(); it != bt.rend() && shown < 2; ++it, ++shown) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Several lookups at once
+    char wanted[] = { 'a', 'b', 'd' };
+    BinarySearchTree<char,int>::iterator found[3];
+    bt.find_many(wanted, wanted + 3, found);
+    for(int i = 0; i < 3; ++i) {
+        cout << wanted[i] << (found[i] != bt.end() ? " found" : " not found") << endl;
+    }
+
+    // Shape of the tree by depth
+    DepthProfile profile = bt.depthProfile();
+    cout << "Leaf depths " << profile.minLeafDepth << " to " << profile.maxLeafDepth
+         << ", " << profile.nodesAtDepth.size() << " levels" << endl;
 /*
     // AVL Tree Tests
     AVLTree<char,int> at;
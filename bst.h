@@ -3,22 +3,257 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <functional>
 #include <utility>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <type_traits>
+#include "node_pool.h"
+#include "depth-profile.h"
+#ifdef BST_STATS
+#include <atomic>
+#endif
+
+// Building with -DBST_STATS turns on the counters behind stats(), and
+// without it every BST_STAT statement compiles away to nothing
+#ifdef BST_STATS
+#define BST_STAT(statement) statement
+#else
+#define BST_STAT(statement)
+#endif
+
+// Starts loading a node the search will look at soon. It is only a
+// hint, so NULL or an address past the end of an array does no harm
+#if defined(__GNUC__)
+#define BST_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define BST_PREFETCH(address)
+#endif
+
+/**
+* What the trees have been doing since the last resetStats(), as a
+* plain copy that can be scraped at any time. Everything stays 0 unless
+* the trees are built with BST_STATS.
+*/
+struct TreeStats
+{
+    // find, lower_bound and upper_bound calls and the key
+    // comparisons they made
+    std::uint64_t lookups;
+    std::uint64_t lookupComparisons;
+    // Inserts and the key comparisons of their descents
+    std::uint64_t inserts;
+    std::uint64_t insertComparisons;
+    // AVL rebalancing after inserts and removes: single and double
+    // rotations, how many updates had to fix balances at all, and how
+    // many levels those fixes climbed in total
+    std::uint64_t singleRotations;
+    std::uint64_t doubleRotations;
+    std::uint64_t rebalances;
+    std::uint64_t rebalanceSteps;
+    // Removes of a node with two children swap it with its predecessor
+    std::uint64_t nodeSwaps;
+    // Deepest node a lookup or insert has reached, the root is depth 1
+    // (hinted inserts count from where their search started)
+    std::uint64_t maxDepth;
+
+    TreeStats() :
+        lookups(0), lookupComparisons(0), inserts(0), insertComparisons(0),
+        singleRotations(0), doubleRotations(0), rebalances(0), rebalanceSteps(0),
+        nodeSwaps(0), maxDepth(0)
+    { }
+};
+
+#ifdef BST_STATS
+/**
+* One live counter. Lookups bump counters from const methods, and under
+* ConcurrentAVLTree many readers do that at once, so the count is an
+* atomic. Bumping it is a relaxed load and store rather than a locked
+* add, which keeps the hot path cheap and free of data races; the price
+* is that readers racing on the same counter can drop a few counts.
+*/
+class StatCounter
+{
+public:
+    StatCounter() : value_(0) { }
+    void add(std::uint64_t n) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void raiseTo(std::uint64_t n) { if (n > value_.load(std::memory_order_relaxed)) value_.store(n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+    void reset() { value_.store(0, std::memory_order_relaxed); }
+private:
+    std::atomic<std::uint64_t> value_;
+};
+
+// The live counters behind TreeStats, one per field
+struct TreeCounters
+{
+    StatCounter lookups, lookupComparisons, inserts, insertComparisons;
+    StatCounter singleRotations, doubleRotations, rebalances, rebalanceSteps;
+    StatCounter nodeSwaps, maxDepth;
+};
+#endif
+
+/**
+* Where an insert gets its item from. One virtual insertFrom serves every
+* kind of insert: it searches with key(), and only then either builds
+* the item inside the new node (build(), called from the node's
+* constructor) or hands the existing value to update(). So an item is
+* never built just to be thrown away, and emplace-style inserts construct
+* the value in place.
+*/
+template <typename Key, typename Value>
+class InsertSource
+{
+public:
+    InsertSource() : added_(false) { }
+    virtual ~InsertSource() { }
+
+    virtual const Key& key() const = 0;
+    // Changes the value of the node already holding key(), returns true
+    // if it did change (an augmented tree then has to update its caches)
+    virtual bool update(Value& value) = 0;
+
+    std::pair<const Key, Value> build()
+    {
+      added_ = true;
+      return make();
+    }
+    bool added() const { return added_; }
+
+protected:
+    virtual std::pair<const Key, Value> make() = 0;
+    bool added_;
+};
+
+/**
+* Copies a key and value in, replacing the value of an existing key.
+* This is what insert(const std::pair<const Key, Value>&) does.
+*/
+template <typename Key, typename Value>
+class CopyInsertSource : public InsertSource<Key, Value>
+{
+public:
+    CopyInsertSource(const Key& key, const Value& value) : key_(key), value_(value) { }
+
+    const Key& key() const { return key_; }
+    bool update(Value& value)
+    {
+      value = value_;
+      return true;
+    }
+
+protected:
+    std::pair<const Key, Value> make() { return std::pair<const Key, Value>(key_, value_); }
+    const Key& key_;
+    const Value& value_;
+};
+
+/**
+* Moves the key and value of a pair in. An existing key gets the value
+* moved over it if overwrite is set and is left alone otherwise.
+*/
+template <typename Key, typename Value>
+class MoveInsertSource : public InsertSource<Key, Value>
+{
+public:
+    MoveInsertSource(std::pair<Key, Value>& item, bool overwrite) : item_(item), overwrite_(overwrite) { }
+
+    const Key& key() const { return item_.first; }
+    bool update(Value& value)
+    {
+      if (overwrite_) {
+        value = std::move(item_.second);
+      }
+      return overwrite_;
+    }
+
+protected:
+    std::pair<const Key, Value> make()
+    {
+      return std::pair<const Key, Value>(std::move(item_.first), std::move(item_.second));
+    }
+    std::pair<Key, Value>& item_;
+    bool overwrite_;
+};
+
+/**
+* Builds the value from constructor arguments, for try_emplace. Nothing
+* is built (or moved from) when the key is already there.
+*/
+template <typename Key, typename Value, typename KeyArg, typename... Args>
+class EmplaceInsertSource : public InsertSource<Key, Value>
+{
+public:
+    EmplaceInsertSource(KeyArg&& key, Args&&... args) :
+      key_(std::forward<KeyArg>(key)), args_(std::forward<Args>(args)...) { }
+
+    const Key& key() const { return key_; }
+    bool update(Value&) { return false; }
+
+protected:
+    std::pair<const Key, Value> make()
+    {
+      return std::pair<const Key, Value>(std::piecewise_construct,
+                                         std::forward_as_tuple(std::forward<KeyArg>(key_)),
+                                         std::move(args_));
+    }
+    KeyArg&& key_;
+    std::tuple<Args&&...> args_;
+};
+
+/**
+* Builds the value from obj for a new key, or assigns obj to the value
+* of an existing one, for insert_or_assign.
+*/
+template <typename Key, typename Value, typename KeyArg, typename M>
+class AssignInsertSource : public InsertSource<Key, Value>
+{
+public:
+    AssignInsertSource(KeyArg&& key, M&& obj) :
+      key_(std::forward<KeyArg>(key)), obj_(std::forward<M>(obj)) { }
+
+    const Key& key() const { return key_; }
+    bool update(Value& value)
+    {
+      value = std::forward<M>(obj_);
+      return true;
+    }
+
+protected:
+    std::pair<const Key, Value> make()
+    {
+      return std::pair<const Key, Value>(std::forward<KeyArg>(key_), std::forward<M>(obj_));
+    }
+    KeyArg&& key_;
+    M&& obj_;
+};
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are plain (non-virtual)
+ * functions so that a walk down the tree compiles to direct
+ * loads and nodes carry no vtable pointer. Node types for
+ * future kinds of search trees, such as Red Black trees,
+ * Splay trees, and AVL trees, derive from Node and hide the
+ * getters with versions that return their own node type
+ * (see AVLNode), which gives the same static dispatch a
+ * CRTP base would.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(InsertSource<Key, Value>& source, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,18 +261,27 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
     std::pair<const Key, Value> item_;
+#ifdef AVL_COMPACT_NODES
+    // In compact mode the low bits of the parent pointer are free
+    // (nodes are at least 8-byte aligned) and derived nodes may keep
+    // a small tag there, see AVLNode. getParent/setParent leave it be.
+    static const std::uintptr_t TAG_MASK = 7;
+    std::uintptr_t parent_;
+#else
     Node<Key, Value>* parent_;
+#endif
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
 };
@@ -54,11 +298,38 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
+#ifdef AVL_COMPACT_NODES
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+#else
     parent_(parent),
+#endif
     left_(NULL),
     right_(NULL)
 {
+#ifdef AVL_COMPACT_NODES
+    static_assert(alignof(Node<Key, Value>) > TAG_MASK,
+                  "compact nodes need the low pointer bits to be free");
+#endif
+}
 
+/**
+* Constructor that builds the item in place from an insert's source.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(InsertSource<Key, Value>& source, Node<Key, Value>* parent) :
+    item_(source.build()),
+#ifdef AVL_COMPACT_NODES
+    parent_(reinterpret_cast<std::uintptr_t>(parent)),
+#else
+    parent_(parent),
+#endif
+    left_(NULL),
+    right_(NULL)
+{
+#ifdef AVL_COMPACT_NODES
+    static_assert(alignof(Node<Key, Value>) > TAG_MASK,
+                  "compact nodes need the low pointer bits to be free");
+#endif
 }
 
 /**
@@ -118,16 +389,20 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for retreiving the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
+#ifdef AVL_COMPACT_NODES
+    return reinterpret_cast<Node<Key, Value>*>(parent_ & ~TAG_MASK);
+#else
     return parent_;
+#endif
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for retreiving the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +411,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for retreiving the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -150,7 +425,11 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
+#ifdef AVL_COMPACT_NODES
+    parent_ = reinterpret_cast<std::uintptr_t>(parent) | (parent_ & TAG_MASK);
+#else
     parent_ = parent;
+#endif
 }
 
 /**
@@ -180,64 +459,296 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+/**
+* A setter that moves the new value in.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* Lets depthWalk and depthProfile (depth-profile.h) walk the tree nodes.
+*/
+template<typename Key, typename Value>
+struct NodeChildren<Node<Key, Value> >
+{
+    static Node<Key, Value>* left(const Node<Key, Value>* node) { return node->getLeft(); }
+    static Node<Key, Value>* right(const Node<Key, Value>* node) { return node->getRight(); }
+};
+
 /**
 * A templated unbalanced binary search tree.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
-    BinarySearchTree(); //DONE
+    explicit BinarySearchTree(const Compare& comp = Compare()); //DONE
     virtual ~BinarySearchTree(); //DONE
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //DONE
     virtual void remove(const Key& key); //DONE
     void clear(); //DONE
     bool isBalanced() const; //DONE
+    // Number of nodes on the longest root to leaf path, 0 when empty
+    virtual int height() const;
+    // Rebuilds the tree into a balanced shape in O(n) time and O(1)
+    // extra space with the Day-Stout-Warren algorithm
+    virtual void rebalance();
+    // Leaf depths and nodes per level in one pass, see depth-profile.h
+    DepthProfile depthProfile() const;
+    // Counters for the hot paths, all 0 unless built with BST_STATS
+    TreeStats stats() const;
+    void resetStats();
+    // Rebuilds subtrees that inserts and removes throw out of balance,
+    // scapegoat style, for alpha in (0.5, 1); 0 turns it off again
+    void setAutoRebalance(double alpha);
     void print() const;
     bool empty() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare> & tree);
+protected:
+    // Lets a derived tree size the node pool for its own node type and
+    // say whether its nodes hold anything that needs a destructor
+    BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign, bool destructNodes, const Compare& comp);
 public:
     /**
-    * An internal iterator class for traversing the contents of the BST.
+    * An internal iterator class for traversing the contents of the BST
+    * without changing it. It is bidirectional; an iterator made by the
+    * tree remembers it, so that stepping back from end() reaches the
+    * largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key,Value>* pointer;
+        typedef const std::pair<const Key,Value>& reference;
+
+        const_iterator();
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare>;
+        const_iterator(Node<Key,Value>* ptr);
+        const_iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
+        // Shared by the iterator classes, steps current_ in key order
+        void increment();
+        void decrement();
+        Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Compare> *tree_;
+    };
+
+    /**
+    * An iterator that can also change the values it visits. It converts
+    * to a const_iterator, so the two can be compared and mixed freely.
     */
-    class iterator  // TODO
+    class iterator : public const_iterator  // TODO
     {
     public:
+        typedef std::pair<const Key,Value>* pointer;
+        typedef std::pair<const Key,Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
         std::pair<const Key,Value>* operator->() const;
 
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Compare>;
         iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Compare>* tree);
+    };
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /**
+    * A pair of iterators that can be used in a range-based for loop.
+    */
+    template<typename It>
+    class basic_range_view
+    {
+    public:
+        basic_range_view(It first, It last);
+
+        It begin() const;
+        It end() const;
+        bool empty() const;
+
+    protected:
+        It first_;
+        It last_;
+    };
+
+    typedef basic_range_view<iterator> range_view;
+    typedef basic_range_view<const_iterator> const_range_view;
+
+    /**
+    * A forward iterator for full in-order scans that keeps the path of
+    * ancestors still to visit on its own stack instead of climbing parent
+    * pointers, so it only ever follows child links. It is read only. The first 64 levels
+    * live inside the iterator, which covers any AVL tree that fits in
+    * memory; deeper (unbalanced) trees spill the rest to the heap.
+    */
+    class scan_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key,Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key,Value>* pointer;
+        typedef const std::pair<const Key,Value>& reference;
+
+        scan_iterator();
+        scan_iterator(const scan_iterator& other);
+        scan_iterator& operator=(const scan_iterator& other);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const scan_iterator& rhs) const;
+        bool operator!=(const scan_iterator& rhs) const;
+
+        scan_iterator& operator++();
+        scan_iterator operator++(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Compare>;
+        static const std::size_t INLINE_DEPTH = 64;
+        explicit scan_iterator(Node<Key,Value>* root);
+        // Pushes node and its chain of left children
+        void pushLeft(Node<Key,Value>* node);
+        Node<Key,Value>* top() const;
+        Node<Key,Value> *inline_[INLINE_DEPTH];
+        std::vector<Node<Key,Value>*> spill_;
+        std::size_t depth_;
     };
 
 public:
-    iterator begin() const;
-    iterator end() const;
-    iterator find(const Key& key) const;
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin();
+    reverse_iterator rend();
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key);
+    const_iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key);
+    std::pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+    range_view range(const Key& low, const Key& high);
+    const_range_view range(const Key& low, const Key& high) const;
+    scan_iterator scanBegin() const;
+    scan_iterator scanEnd() const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
+    Compare key_comp() const;
+
+    // Lookups by anything the comparator can compare with a Key, such as
+    // a const char* or string_view for string keys, so no temporary Key
+    // is built. Only there when Compare has an is_transparent member
+    // type, like std::less<>.
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const;
+
+    // Writes find(key) for every key in [first, last) to out, in order.
+    // The searches go down FIND_LANES at a time in lockstep, so their
+    // cache misses overlap instead of coming one after another.
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out);
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const;
+
+    // Inserts that move or build the item into the node instead of
+    // copying it. insert overwrites an existing value like the insert
+    // above; emplace and try_emplace leave it alone, as std::map does.
+    template<typename P>
+    typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value>::type
+    insert(P&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
+    // Inserts that start searching near an earlier position
+    iterator insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename InputIt>
+    void insertBatch(InputIt first, InputIt last);
 
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; //DONE
+    Node<Key, Value>* internalLowerBound(const Key& k) const;
+    Node<Key, Value>* internalUpperBound(const Key& k) const;
+    // The searches behind the three above, for any key type the
+    // comparator takes. Each makes one comparison per level.
+    template<typename K>
+    Node<Key, Value>* findNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* lowerBoundNode(const K& key) const;
+    template<typename K>
+    Node<Key, Value>* upperBoundNode(const K& key) const;
+    // The search behind find_many. It calls found(node) for every key
+    // in order, with NULL for the ones that are not in the tree
+    enum { FIND_LANES = 32 };
+    template<typename ForwardIt, typename Found>
+    void findManyNodes(ForwardIt first, ForwardIt last, Found found) const;
+    // Lets derived trees hand out iterators to their nodes
+    iterator iteratorAt(Node<Key, Value>* node);
+    const_iterator iteratorAt(Node<Key, Value>* node) const;
     Node<Key, Value> *getSmallestNode() const;  //DONE
+    Node<Key, Value> *getLargestNode() const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); //DONE
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -250,52 +761,101 @@ protected:
     // Add a helper function for traversal of the tree since a lot of 
     // function may require this
     // Node<Key, Value>* traverse(const Key& k) const;
-    // Add a function for the recursive algorithm in clear()
+    // Destroys every node below curr in O(1) extra space
     void clear2(Node<Key, Value>* curr);
-    // Add a function for the recursive algorithm in getSmallestNode()
+    // Inserts with the descent starting at start, which must be a
+    // node whose subtree could hold the key (or NULL on an empty
+    // tree), and returns the node that holds the key afterwards
+    virtual Node<Key, Value>* insertFrom(Node<Key, Value>* start, InsertSource<Key, Value>& source);
+    // Climbs from a node near the key to where insertFrom can start
+    Node<Key, Value>* fingerStart(Node<Key, Value>* finger, const Key& key) const;
+    // Node storage helpers, every node lives in pool_
+    Node<Key, Value>* createNode(InsertSource<Key, Value>& source, Node<Key, Value>* parent);
+    void destroyNode(Node<Key, Value>* node);
+    // Runs the destructor of the tree's own node type, since
+    // nodes no longer have a virtual destructor
+    virtual void destructNode(Node<Key, Value>* node);
+    // Returns the left most node below curr
     Node<Key, Value>* getSmallestNode2(Node<Key, Value>* curr) const;
-    // Add a function for the recursive algorithm in isBalanced()
-    bool balance2(Node<Key, Value>* curr, int& height) const;
+    // Helpers for rebalance(), rebuild works on the subtree at top
+    void rebuild(Node<Key, Value>* top);
+    void compress(Node<Key, Value>* parent, bool onLeft, std::size_t count);
+    void replaceChild(Node<Key, Value>* parent, Node<Key, Value>* oldChild, Node<Key, Value>* newChild);
+    std::size_t subtreeSize(Node<Key, Value>* top) const;
+    // Finds and rebuilds the scapegoat above a new node that is too deep
+    void autoRebalance(Node<Key, Value>* added);
+#ifdef BST_STATS
+    // Record a descent that went depth levels down, with one comparison
+    // per level and the equality check after it
+    void countLookup(std::uint64_t depth) const;
+    void countInsert(std::uint64_t depth, bool equalityCheck, bool added) const;
+#endif
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // Arena that owns the memory of every node in the tree
+    NodePool pool_;
+    // Whether clear() has to run the destructor of every node
+    bool destructNodes_;
+    // Orders the keys, every key comparison goes through it
+    Compare comp_;
+    // Auto rebalance weight, 0 when it is off, and the most nodes
+    // the tree has held since the last full rebuild
+    double rebalanceAlpha_;
+    std::size_t maxSize_;
+#ifdef BST_STATS
+    // Bumped from const lookups too, see StatCounter
+    mutable TreeCounters counters_;
+#endif
 };
 
 /*
---------------------------------------------------------------
-Begin implementations for the BinarySearchTree::iterator class.
----------------------------------------------------------------
+--------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+--------------------------------------------------------------------
 */
 
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) :
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator(Node<Key,Value> *ptr) :
   // Initialize to the given pointer
-  current_(ptr)
+  current_(ptr),
+  tree_(NULL)
+{
+}
+
+/**
+* Constructor for iterators handed out by a tree, which can step back
+* from the end.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Compare>* tree) :
+  current_(ptr),
+  tree_(tree)
 {
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator() 
 {
   // Just initialize to NULL
   current_ = NULL;
+  tree_ = NULL;
 
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator*() const
 {
   return current_->getItem();
 }
@@ -303,9 +863,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator->() const
 {
   return &(current_->getItem());
 }
@@ -314,10 +874,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
 {
   // Must check if the lhs and rhs iterators are the same node
   return current_ == rhs.current_;
@@ -327,10 +887,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
 {
   // Must check if the lhs and rhs iterators are pointing
   // to different nodes
@@ -342,13 +902,56 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++()
+{
+  increment();
+  return *this;
+}
+
+/**
+* Advances the iterator and returns where it was.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+  const_iterator old = *this;
+  increment();
+  return old;
+}
+
+/**
+* Moves the iterator back to the in-order predecessor. Stepping back
+* from end() goes to the largest item.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--()
+{
+  decrement();
+  return *this;
+}
+
+/**
+* Moves the iterator back and returns where it was.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+  const_iterator old = *this;
+  decrement();
+  return old;
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::const_iterator::increment()
 {
-  // Just return the pointer if the current iterator points to NULL
+  // Nothing to do if the current iterator points to NULL
   if (current_ == NULL) {
-    return *this;
+    return;
   }
 
   // Move to the right after going to the left most subtree
@@ -371,160 +974,1031 @@ BinarySearchTree<Key, Value>::iterator::operator++()
     current_ = parent;
   }
 
-  return *this;
-
 }
 
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::const_iterator::decrement()
+{
+  if (current_ == NULL) {
+    if (tree_ != NULL) {
+      current_ = tree_->getLargestNode();
+    }
+  }
+  else {
+    current_ = predecessor(current_);
+  }
+}
 
 /*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
+------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+------------------------------------------------------------------
 */
 
 /*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+--------------------------------------------------------------
+Begin implementations for the BinarySearchTree::iterator class.
+---------------------------------------------------------------
 */
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* Explicit constructor that initializes an iterator with a given node pointer.
 */
-// SEVENTH: Create the binary search tree by just 
-// making an empty tree (set root to NULL)
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr) :
+  const_iterator(ptr)
 {
-  root_ = NULL;
 }
 
-// EIGTH: Just free all the nodes with the clear() function
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor for iterators handed out by a tree.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Compare>* tree) :
+  const_iterator(ptr, tree)
 {
-  clear();
 }
 
 /**
- * Returns true if tree is empty
+* A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator()
 {
-    return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare>::iterator::operator*() const
 {
-    printRoot(root_);
-    std::cout << "\n";
+  return this->current_->getItem();
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* Provides access to the address of the item.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare>
+std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare>::iterator::operator->() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+  return &(this->current_->getItem());
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator++()
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+  this->increment();
+  return *this;
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* Advances the iterator and returns where it was.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator++(int)
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+  iterator old = *this;
+  this->increment();
+  return old;
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
-{
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
-}
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+* Moves the iterator back to the in-order predecessor.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator--()
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+  this->decrement();
+  return *this;
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Moves the iterator back and returns where it was.
 */
-// FIRST: Write the function for insert for this BST class
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator--(int)
 {
-    // First we always check if the data structure is empty or not
-    if (root_ == NULL) {
-      // If it is empty, we must create the start of the tree
+  iterator old = *this;
+  this->decrement();
+  return old;
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator class.
+-------------------------------------------------------------
+*/
+
+/**
+* Constructs a view of the items in [first, last).
+*/
+template<class Key, class Value, class Compare>
+template<typename It>
+BinarySearchTree<Key, Value, Compare>::basic_range_view<It>::basic_range_view(It first, It last) :
+  first_(first),
+  last_(last)
+{
+}
+
+/**
+* Returns an iterator to the first item in the view.
+*/
+template<class Key, class Value, class Compare>
+template<typename It>
+It BinarySearchTree<Key, Value, Compare>::basic_range_view<It>::begin() const
+{
+  return first_;
+}
+
+/**
+* Returns an iterator just past the last item in the view.
+*/
+template<class Key, class Value, class Compare>
+template<typename It>
+It BinarySearchTree<Key, Value, Compare>::basic_range_view<It>::end() const
+{
+  return last_;
+}
+
+/**
+* Returns true iff the view holds no items.
+*/
+template<class Key, class Value, class Compare>
+template<typename It>
+bool BinarySearchTree<Key, Value, Compare>::basic_range_view<It>::empty() const
+{
+  return first_ == last_;
+}
+
+/*
+------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::scan_iterator class.
+------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that makes an end iterator.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::scan_iterator::scan_iterator() :
+  depth_(0)
+{
+}
+
+/**
+* Starts a scan at the smallest node under root.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::scan_iterator::scan_iterator(Node<Key,Value> *root) :
+  depth_(0)
+{
+  pushLeft(root);
+}
+
+/**
+* Copy constructor, only the used part of the stack is copied.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::scan_iterator::scan_iterator(const scan_iterator& other) :
+  spill_(other.spill_),
+  depth_(other.depth_)
+{
+  std::size_t used = depth_ < INLINE_DEPTH ? depth_ : INLINE_DEPTH;
+  for (std::size_t i = 0; i < used; i++) {
+    inline_[i] = other.inline_[i];
+  }
+}
+
+/**
+* Assignment operator, only the used part of the stack is copied.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::scan_iterator&
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator=(const scan_iterator& other)
+{
+  if (this != &other) {
+    spill_ = other.spill_;
+    depth_ = other.depth_;
+    std::size_t used = depth_ < INLINE_DEPTH ? depth_ : INLINE_DEPTH;
+    for (std::size_t i = 0; i < used; i++) {
+      inline_[i] = other.inline_[i];
+    }
+  }
+  return *this;
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator*() const
+{
+  return top()->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator->() const
+{
+  return &(top()->getItem());
+}
+
+/**
+* Two scans are equal when they are at the same node (or both at the end).
+*/
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator==(const scan_iterator& rhs) const
+{
+  if (depth_ == 0 || rhs.depth_ == 0) {
+    return depth_ == rhs.depth_;
+  }
+  return top() == rhs.top();
+}
+
+/**
+* The opposite of operator==.
+*/
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator!=(const scan_iterator& rhs) const
+{
+  return !(*this == rhs);
+}
+
+/**
+* Advances to the next key: pop the current node and push the left
+* spine of its right subtree. The node below it on the stack is the
+* nearest ancestor we went left at, which is next when there is no
+* right subtree.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::scan_iterator&
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator++()
+{
+  if (depth_ == 0) {
+    return *this;
+  }
+  Node<Key, Value>* curr = top();
+  if (depth_ > INLINE_DEPTH) {
+    spill_.pop_back();
+  }
+  depth_--;
+  pushLeft(curr->getRight());
+  return *this;
+}
+
+/**
+* Advances the scan and returns where it was. This copies the stack, so
+* prefer the prefix form in loops.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::scan_iterator
+BinarySearchTree<Key, Value, Compare>::scan_iterator::operator++(int)
+{
+  scan_iterator old = *this;
+  ++(*this);
+  return old;
+}
+
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::scan_iterator::pushLeft(Node<Key,Value>* node)
+{
+  while (node != NULL) {
+    if (depth_ < INLINE_DEPTH) {
+      inline_[depth_] = node;
+    }
+    else {
+      spill_.push_back(node);
+    }
+    depth_++;
+    node = node->getLeft();
+  }
+}
+
+template<class Key, class Value, class Compare>
+Node<Key,Value>* BinarySearchTree<Key, Value, Compare>::scan_iterator::top() const
+{
+  return depth_ > INLINE_DEPTH ? spill_.back() : inline_[depth_ - 1];
+}
+
+/*
+----------------------------------------------------------------
+End implementations for the BinarySearchTree::scan_iterator class.
+----------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+// SEVENTH: Create the binary search tree by just 
+// making an empty tree (set root to NULL)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const Compare& comp) :
+  pool_(sizeof(Node<Key, Value>), alignof(Node<Key, Value>)),
+  destructNodes_(!std::is_trivially_destructible<Key>::value ||
+                 !std::is_trivially_destructible<Value>::value),
+  comp_(comp),
+  rebalanceAlpha_(0),
+  maxSize_(0)
+{
+  root_ = NULL;
+}
+
+/**
+* Constructor for derived trees whose nodes are bigger than a plain Node.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign, bool destructNodes, const Compare& comp) :
+  pool_(nodeSize, nodeAlign),
+  destructNodes_(destructNodes),
+  comp_(comp),
+  rebalanceAlpha_(0),
+  maxSize_(0)
+{
+  root_ = NULL;
+}
+
+// EIGTH: Just free all the nodes with the clear() function
+template<typename Key, typename Value, typename Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree()
+{
+  clear();
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin()
+{
+    BinarySearchTree<Key, Value, Compare>::iterator begin(getSmallestNode(), this);
+    return begin;
+}
+
+/**
+* Returns a const_iterator to the "smallest" item in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(getSmallestNode(), this);
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end()
+{
+    BinarySearchTree<Key, Value, Compare>::iterator end(NULL, this);
+    return end;
+}
+
+/**
+* Returns a const_iterator whose value means INVALID
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(NULL, this);
+}
+
+/**
+* Same as begin() const, for non-const trees too.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Same as end() const, for non-const trees too.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the largest item, so walking from
+* rbegin() to rend() visits the keys in descending order. The first N
+* items cost O(log n + N).
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin()
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the end of a reverse walk.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend()
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Returns a read only reverse iterator to the largest item.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+/**
+* Returns the end of a read only reverse walk.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+/**
+* Same as rbegin() const, for non-const trees too.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crbegin() const
+{
+    return rbegin();
+}
+
+/**
+* Same as rend() const, for non-const trees too.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crend() const
+{
+    return rend();
+}
+
+/**
+* Returns a scan iterator to the "smallest" item in the tree. Use it
+* with scanEnd() for full scans that never touch a parent pointer.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::scan_iterator
+BinarySearchTree<Key, Value, Compare>::scanBegin() const
+{
+    return scan_iterator(root_);
+}
+
+/**
+* Returns the end of a scan.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::scan_iterator
+BinarySearchTree<Key, Value, Compare>::scanEnd() const
+{
+    return scan_iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k)
+{
+    Node<Key, Value> *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Compare>::iterator it(curr, this);
+    return it;
+}
+
+/**
+* Returns a const_iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k) const
+{
+    return const_iterator(internalFind(k), this);
+}
+
+/**
+* Returns an iterator to the given node, or the end iterator for NULL.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iteratorAt(Node<Key, Value>* node)
+{
+    return iterator(node, this);
+}
+
+/**
+* Returns a const_iterator to the given node, or the end iterator for NULL.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::iteratorAt(Node<Key, Value>* node) const
+{
+    return const_iterator(node, this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key & k)
+{
+    return iterator(internalLowerBound(k), this);
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key & k) const
+{
+    return const_iterator(internalLowerBound(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key & k)
+{
+    return iterator(internalUpperBound(k), this);
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key & k) const
+{
+    return const_iterator(internalUpperBound(k), this);
+}
+
+/**
+* Returns the range of items whose key is k, which holds one item
+* or none since keys are unique
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key & k)
+{
+    iterator first(internalLowerBound(k), this);
+    iterator last = first;
+    if (last != end() && !comp_(k, last->first)) {
+      ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::const_iterator,
+          typename BinarySearchTree<Key, Value, Compare>::const_iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key & k) const
+{
+    const_iterator first(internalLowerBound(k), this);
+    const_iterator last = first;
+    if (last != end() && !comp_(k, last->first)) {
+      ++last;
+    }
+    return std::make_pair(first, last);
+}
+
+/**
+* Returns a view of the items with keys in [low, high). Finding the ends
+* takes O(log n) on a balanced tree and walking the k items in between
+* takes O(k) more.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::range_view
+BinarySearchTree<Key, Value, Compare>::range(const Key & low, const Key & high)
+{
+    iterator first(internalLowerBound(low), this);
+    // An empty or backwards interval gives an empty view
+    if (!comp_(low, high)) {
+      return range_view(first, first);
+    }
+    return range_view(first, iterator(internalLowerBound(high), this));
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_range_view
+BinarySearchTree<Key, Value, Compare>::range(const Key & low, const Key & high) const
+{
+    const_iterator first(internalLowerBound(low), this);
+    if (!comp_(low, high)) {
+      return const_range_view(first, first);
+    }
+    return const_range_view(first, const_iterator(internalLowerBound(high), this));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* Returns a copy of the comparator that orders the keys.
+*/
+template<class Key, class Value, class Compare>
+Compare BinarySearchTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns an iterator to the item whose key is equivalent to k, or the
+* end iterator. k can be of any type the transparent comparator accepts.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K & k)
+{
+    return iterator(findNode(k), this);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::find(const K & k) const
+{
+    return const_iterator(findNode(k), this);
+}
+
+/**
+* Heterogeneous lower_bound, see find above.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K & k)
+{
+    return iterator(lowerBoundNode(k), this);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const K & k) const
+{
+    return const_iterator(lowerBoundNode(k), this);
+}
+
+/**
+* Heterogeneous upper_bound, see find above.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K & k)
+{
+    return iterator(upperBoundNode(k), this);
+}
+
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const K & k) const
+{
+    return const_iterator(upperBoundNode(k), this);
+}
+
+/**
+* Writes an iterator to the item with each key in [first, last), or the
+* end iterator, to out and returns out past the last one.
+*/
+template<class Key, class Value, class Compare>
+template<typename ForwardIt, typename OutputIt>
+OutputIt BinarySearchTree<Key, Value, Compare>::find_many(ForwardIt first, ForwardIt last, OutputIt out)
+{
+    findManyNodes(first, last, [&](Node<Key, Value>* node) {
+        *out = iterator(node, this);
+        ++out;
+    });
+    return out;
+}
+
+template<class Key, class Value, class Compare>
+template<typename ForwardIt, typename OutputIt>
+OutputIt BinarySearchTree<Key, Value, Compare>::find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+{
+    findManyNodes(first, last, [&](Node<Key, Value>* node) {
+        *out = const_iterator(node, this);
+        ++out;
+    });
+    return out;
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+// FIRST: Write the function for insert for this BST class
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // A plain insert searches from the root
+    CopyInsertSource<Key, Value> source(keyValuePair.first, keyValuePair.second);
+    insertFrom(root_, source);
+}
+
+/**
+* Inserts a pair that can be moved from (or anything a std::pair<Key, Value>
+* can be built from), overwriting the value if the key is already there.
+* The key and value are moved into the node instead of copied.
+*/
+template<class Key, class Value, class Compare>
+template<typename P>
+typename std::enable_if<std::is_constructible<std::pair<Key, Value>, P&&>::value>::type
+BinarySearchTree<Key, Value, Compare>::insert(P&& keyValuePair)
+{
+    std::pair<Key, Value> item(std::forward<P>(keyValuePair));
+    MoveInsertSource<Key, Value> source(item, true);
+    insertFrom(root_, source);
+}
+
+/**
+* Builds a pair from args and inserts it if its key is not in the tree
+* yet. Returns an iterator to the pair with that key and whether the
+* insert happened. The pair has to be built before its key is known, so
+* it is then moved into the node.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(Args&&... args)
+{
+    std::pair<Key, Value> item(std::forward<Args>(args)...);
+    MoveInsertSource<Key, Value> source(item, false);
+    Node<Key, Value>* node = insertFrom(root_, source);
+    return std::make_pair(iterator(node, this), source.added());
+}
+
+/**
+* Inserts key with a value built in place from args if key is not in the
+* tree yet. Nothing is built or moved from if it is. Returns an iterator
+* to the pair with that key and whether the insert happened.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    EmplaceInsertSource<Key, Value, const Key&, Args...> source(key, std::forward<Args>(args)...);
+    Node<Key, Value>* node = insertFrom(root_, source);
+    return std::make_pair(iterator(node, this), source.added());
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    EmplaceInsertSource<Key, Value, Key, Args...> source(std::move(key), std::forward<Args>(args)...);
+    Node<Key, Value>* node = insertFrom(root_, source);
+    return std::make_pair(iterator(node, this), source.added());
+}
+
+/**
+* Inserts key with a value built from obj, or assigns obj to the value
+* if key is already there. Returns an iterator to the pair with that key
+* and whether a new pair was inserted.
+*/
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(const Key& key, M&& obj)
+{
+    AssignInsertSource<Key, Value, const Key&, M> source(key, std::forward<M>(obj));
+    Node<Key, Value>* node = insertFrom(root_, source);
+    return std::make_pair(iterator(node, this), source.added());
+}
+
+template<class Key, class Value, class Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::insert_or_assign(Key&& key, M&& obj)
+{
+    AssignInsertSource<Key, Value, Key, M> source(std::move(key), std::forward<M>(obj));
+    Node<Key, Value>* node = insertFrom(root_, source);
+    return std::make_pair(iterator(node, this), source.added());
+}
+
+/**
+* Inserts a pair like insert(), but starts the search from hint instead of
+* the root. When the key belongs next to hint, only the few nodes between
+* them are visited. Any hint is correct, a far away one is just slower.
+* Returns an iterator to the pair with the key.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* start = fingerStart(hint.current_, keyValuePair.first);
+    CopyInsertSource<Key, Value> source(keyValuePair.first, keyValuePair.second);
+    return iterator(insertFrom(start, source), this);
+}
+
+/**
+* Inserts every pair in [first, last). Each search starts from the pair
+* inserted before it, so runs of sorted or nearly sorted keys don't go
+* back to the root every time.
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare>::insertBatch(InputIt first, InputIt last)
+{
+    Node<Key, Value>* finger = NULL;
+    for (; first != last; ++first) {
+      CopyInsertSource<Key, Value> source(first->first, first->second);
+      finger = insertFrom(fingerStart(finger, first->first), source);
+    }
+}
+
+// Helper function for the inserts above that does the actual insertion
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::insertFrom(
+    Node<Key, Value>* start, InsertSource<Key, Value>& source)
+{
+    // First we always check if the data structure is empty or not
+    if (root_ == NULL) {
+      // If it is empty, we must create the start of the tree
       // The parent of the pair is NULL
-      root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-      return;
+      root_ = createNode(source, NULL);
+      BST_STAT(countInsert(0, false, true);)
+      return root_;
     }
 
+    const Key& key = source.key();
     // Now we must traverse the tree to find where to put the new value
-    Node<Key, Value>* target = root_;
+    Node<Key, Value>* target = start;
     Node<Key, Value>* parent = NULL;
-    // Go until the end of the tree is not reached
+    // The last node we went right at, its key is the largest one
+    // that is not greater than the new key
+    Node<Key, Value>* candidate = NULL;
+    bool goLeft = false;
+    // Go until the end of the tree is not reached, with one
+    // comparison per level
+    BST_STAT(std::uint64_t depth = 0;)
     while (target != NULL)  {
+      BST_STAT(depth++;)
       parent = target;
       // If the target is greater than the given key value,
       // we go left. Otherwise we go right (use BST property)
-      if (keyValuePair.first < target->getKey())  {
+      goLeft = comp_(key, target->getKey());
+      if (goLeft)  {
         target = target->getLeft();
       }
-      else if (keyValuePair.first > target->getKey())  {
-        target = target->getRight();
-      }
-      // Must update the value at that node if a key already exists 
       else  {
-        target->setValue(keyValuePair.second);
-        return;
+        candidate = target;
+        target = target->getRight();
       }
     }
 
+    // Must update the value at that node if a key already exists 
+    if (candidate != NULL && !comp_(candidate->getKey(), key)) {
+      BST_STAT(countInsert(depth, true, false);)
+      source.update(candidate->getValue());
+      return candidate;
+    }
+
+    BST_STAT(countInsert(depth, candidate != NULL, true);)
     // Once the correct position is found, we must update the new value
-    Node<Key, Value>* node = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent);
+    Node<Key, Value>* node = createNode(source, parent);
     // Same logic, change left vs right child based on BST property
-    if (keyValuePair.first < parent->getKey())  {
+    if (goLeft)  {
       parent->setLeft(node);
     }
     else  {
       parent->setRight(node);
     }
+    if (rebalanceAlpha_ > 0)  {
+      autoRebalance(node);
+    }
+    return node;
+
+}
+
+// Helper function that finds where a search for key can start, given a
+// finger node that is (hopefully) close to it. Every subtree holds the
+// keys between two ancestors: the nearest one it hangs to the right of
+// and the nearest one it hangs to the left of. The finger already bounds
+// the key on one side, so we climb until an ancestor bounds the other side
+// too. Nodes on a run of same-side links share that bound, so the start is
+// the lowest node of the run rather than the node we stopped at.
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::fingerStart(Node<Key, Value>* finger, const Key& key) const
+{
+    if (finger == NULL) {
+      return root_;
+    }
 
+    Node<Key, Value>* start = finger;
+    Node<Key, Value>* curr = finger;
+    Node<Key, Value>* parent = curr->getParent();
+    if (comp_(key, finger->getKey())) {
+      // Need an ancestor on our left with a smaller key
+      while (parent != NULL) {
+        if (curr == parent->getRight()) {
+          if (comp_(parent->getKey(), key)) {
+            return start;
+          }
+          if (!comp_(key, parent->getKey())) {
+            return parent;
+          }
+          start = parent;
+        }
+        curr = parent;
+        parent = parent->getParent();
+      }
+    }
+    else if (comp_(finger->getKey(), key)) {
+      // Need an ancestor on our right with a bigger key
+      while (parent != NULL) {
+        if (curr == parent->getLeft()) {
+          if (comp_(key, parent->getKey())) {
+            return start;
+          }
+          if (!comp_(parent->getKey(), key)) {
+            return parent;
+          }
+          start = parent;
+        }
+        curr = parent;
+        parent = parent->getParent();
+      }
+    }
+    return start;
 }
 
 
@@ -537,8 +2011,8 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 // - Remove the leaf nodes
 // - Promote the child of a node with one child
 // - Swap with its predecessor of a node with two children
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key)
 {
   // First lets store the position of the node we want to remove
   // and parent/child nodes
@@ -595,15 +2069,20 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     }
 
   // Finally do the actual removal
-  delete target;
+  destroyNode(target);
 
+  // Once enough keys are gone the depth bound no longer holds for
+  // the smaller size, so rebuild the whole tree
+  if (rebalanceAlpha_ > 0 && pool_.size() < rebalanceAlpha_ * maxSize_)  {
+    rebalance();
+  }
 }
 
 // THIRD: This is a static function for checking in-order predecessor
 // of a target node and it is the largest key that is < the current node
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current)
 {
   // First check if the node is null
   if (current == NULL)  {
@@ -642,34 +2121,83 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 * reset the values in the tree for use again.
 */
 // FOURTH: Essentially we want to make an empty tree
-// so just delete every single node in a recursive function
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+// so just delete every single node, without recursing
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear()
 {
-  // Just call the helper and the set the root to NULL
-  // to create an empty tree
-  clear2(root_);
+  // Nodes that need no destructor can simply be dropped
+  // with their slabs, so only walk the tree when they do
+  if (destructNodes_)  {
+    clear2(root_);
+  }
+  // Then hand all the node memory back at once and
+  // set the root to NULL to create an empty tree
+  pool_.release();
   root_ = NULL;
+  maxSize_ = 0;
 }
 
 // Helper function for the clear() function above
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear2(Node<Key, Value>* curr)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear2(Node<Key, Value>* curr)
 {
-  // We initially get the root of a tree and delete from 
-  // bottom to top with head recursion
-  // Base case checks if tree is empty
-  if (curr == NULL) {
-    return;
+  // Recursing on both children needs a stack frame per level, which
+  // overflows on a degenerate tree a million nodes deep. Instead we
+  // rotate left children up one at a time, turning the tree into a
+  // vine of right pointers that we destroy as we walk down it
+  while (curr != NULL) {
+    Node<Key, Value>* left = curr->getLeft();
+    if (left != NULL) {
+      // Right rotation, only the child pointers matter since every
+      // node is about to go
+      curr->setLeft(left->getRight());
+      left->setRight(curr);
+      curr = left;
+    }
+    else {
+      // Nothing smaller is left, so destroy the node and move on,
+      // its memory goes away with the pool
+      Node<Key, Value>* right = curr->getRight();
+      destructNode(curr);
+      curr = right;
+    }
   }
+}
 
-  // Recursive case calls left and right subtree
-  clear2(curr->getLeft());
-  clear2(curr->getRight());
+/**
+* Builds a node in a slot taken from the node pool.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::createNode(
+    InsertSource<Key, Value>& source, Node<Key, Value>* parent)
+{
+  void* slot = pool_.allocate();
+  try {
+    return new (slot) Node<Key, Value>(source, parent);
+  }
+  catch (...) {
+    pool_.deallocate(slot);
+    throw;
+  }
+}
 
-  // Delete the current node
-  delete curr;
+/**
+* Destroys a node and puts its slot back on the pool's free list.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(Node<Key, Value>* node)
+{
+  destructNode(node);
+  pool_.deallocate(node);
+}
 
+/**
+* Runs the destructor of a node without giving back its memory.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destructNode(Node<Key, Value>* node)
+{
+  node->~Node();
 }
 
 /**
@@ -678,9 +2206,9 @@ void BinarySearchTree<Key, Value>::clear2(Node<Key, Value>* curr)
 // FIFTH: We must return a pointer to the smallest node in the tree
 // so my approach is to solve this recursively by finding the lestmost
 // node
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode() const
 {
   // Use the helper and return it
   // We start at the root
@@ -688,27 +2216,42 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 }
 
 // Helper function for getSmallestNode() function above
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode2(Node<Key, Value>* curr) const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode2(Node<Key, Value>* curr) const
 {
-  // Base case checks if we are at the end or left most node
-  if (curr == NULL || curr->getLeft() == NULL)  {
+  // Keep going left until we are at the left most node, in a loop
+  // so a degenerate tree cannot run us out of stack
+  if (curr == NULL) {
     return curr;
   }
+  while (curr->getLeft() != NULL) {
+    curr = curr->getLeft();
+  }
+  return curr;
+}
 
-  // Recursive case keeps going left
-  curr = curr->getLeft();
-  return getSmallestNode2(curr);
-  
+/**
+* A helper function to find the largest node in the tree, which is
+* where a backwards walk from end() starts.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::getLargestNode() const
+{
+  Node<Key, Value>* curr = root_;
+  while (curr != NULL && curr->getRight() != NULL) {
+    curr = curr->getRight();
+  }
+  return curr;
 }
 
 // This is my helper function to traverse the tree
 // I just realized this is a function we have to implement anyway
 // called internalFind()
 /*
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::traverse(const Key& k) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::traverse(const Key& k) const
 {
   // First store the node we are using and its parent
   Node<Key, Value>* curr = root_;
@@ -742,101 +2285,529 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::traverse(const Key& k) const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const Key& key) const
+{
+  return findNode(key);
+}
+
+/**
+* Helper function to find the node with the smallest key that is not
+* less than k, or NULL if every key is less than k.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalLowerBound(const Key& key) const
+{
+  return lowerBoundNode(key);
+}
+
+/**
+* Helper function to find the node with the smallest key that is
+* greater than k, or NULL if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalUpperBound(const Key& key) const
+{
+  return upperBoundNode(key);
+}
+
+// Finds the node equivalent to key. Rather than testing <, > and == at
+// every node, it goes down like lowerBoundNode with one comparison per
+// level and then checks the one node it ends on.
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::findNode(const K& key) const
+{
+  Node<Key, Value>* result = lowerBoundNode(key);
+  BST_STAT(counters_.lookupComparisons.add(result != NULL);)
+  if (result != NULL && !comp_(key, result->getKey())) {
+    return result;
+  }
+  return NULL;
+}
+
+// Goes down once, remembering the last node where it had to turn left
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::lowerBoundNode(const K& key) const
+{
+  Node<Key, Value>* curr = root_;
+  Node<Key, Value>* result = NULL;
+  BST_STAT(std::uint64_t depth = 0;)
+  while (curr != NULL)  {
+    BST_STAT(depth++;)
+    if (comp_(curr->getKey(), key)) {
+      curr = curr->getRight();
+    }
+    else  {
+      result = curr;
+      curr = curr->getLeft();
+    }
+  }
+  BST_STAT(countLookup(depth);)
+  return result;
+}
+
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::upperBoundNode(const K& key) const
 {
-  // First store the node we are using and its parent
   Node<Key, Value>* curr = root_;
+  Node<Key, Value>* result = NULL;
+  BST_STAT(std::uint64_t depth = 0;)
+  while (curr != NULL)  {
+    BST_STAT(depth++;)
+    if (comp_(key, curr->getKey())) {
+      result = curr;
+      curr = curr->getLeft();
+    }
+    else  {
+      curr = curr->getRight();
+    }
+  }
+  BST_STAT(countLookup(depth);)
+  return result;
+}
 
-  if (curr == NULL) {
-    return NULL;
+// Runs up to FIND_LANES lower bound descents side by side, one level of
+// each per round. A lane prefetches its next node as soon as it knows it,
+// and the other lanes' work covers the time that load takes. Sorted keys
+// go the same way: walking from one key's node to the next only pays off
+// when nearly every node is looked up and the nodes sit in key order in
+// memory, and otherwise it is one miss at a time again.
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt, typename Found>
+void BinarySearchTree<Key, Value, Compare>::findManyNodes(ForwardIt first, ForwardIt last, Found found) const
+{
+  ForwardIt probe[FIND_LANES];
+  Node<Key, Value>* curr[FIND_LANES];
+  Node<Key, Value>* result[FIND_LANES];
+  BST_STAT(std::uint64_t depth[FIND_LANES];)
+  while (first != last) {
+    int count = 0;
+    for (; count < FIND_LANES && first != last; ++first, ++count) {
+      probe[count] = first;
+      curr[count] = root_;
+      result[count] = NULL;
+      BST_STAT(depth[count] = 0;)
+    }
+
+    bool active = root_ != NULL;
+    while (active) {
+      active = false;
+      for (int i = 0; i < count; i++) {
+        Node<Key, Value>* node = curr[i];
+        if (node == NULL) {
+          continue;
+        }
+        BST_STAT(depth[i]++;)
+        if (comp_(node->getKey(), *probe[i])) {
+          node = node->getRight();
+        }
+        else {
+          result[i] = node;
+          node = node->getLeft();
+        }
+        BST_PREFETCH(node);
+        curr[i] = node;
+        active = active || node != NULL;
+      }
+    }
+
+    for (int i = 0; i < count; i++) {
+      BST_STAT(countLookup(depth[i]);)
+      BST_STAT(counters_.lookupComparisons.add(result[i] != NULL);)
+      bool match = result[i] != NULL && !comp_(*probe[i], result[i]->getKey());
+      found(match ? result[i] : NULL);
+    }
   }
+}
 
-  if (root_->getKey() == key) {
-    return root_;
+/**
+ * Return true iff the BST is balanced.
+ */
+// SIXTH: Working with traversing the BST tree to check if left
+// subtree height is within 1 of right subtree height. We visit the
+// children before the node with our own stack instead of recursing,
+// and stop at the first node that is out of balance
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const
+{
+  // A tree where every node is balanced is an AVL shape, and the
+  // fewest nodes one of height h can have grows like the Fibonacci
+  // numbers. So with this many nodes no balanced tree is taller than
+  // maxHeight, and any deeper path means we can answer false right
+  // away. It also caps our stack, even on a degenerate tree
+  std::size_t nodes = pool_.size();
+  int maxHeight = 0;
+  std::size_t shorter = 0;  // Fewest nodes for height maxHeight - 1
+  std::size_t taller = 0;   // Fewest nodes for height maxHeight
+  while (nodes - taller >= shorter + 1) {
+    std::size_t next = taller + shorter + 1;
+    shorter = taller;
+    taller = next;
+    maxHeight++;
   }
-  else  {
 
-    while (curr != NULL)  {
+  // One entry per node on the path from the root, enough for any
+  // balanced tree a 64 bit node count can describe
+  struct Frame {
+    Node<Key, Value>* node;
+    int leftHeight;
+    bool leftDone;
+  };
+  Frame stack[96];
+  int depth = 0;
 
-      // Now traverse using the BST property
-      if (key < curr->getKey())  {
-        // Set it to the left node
-        curr = curr->getLeft();
+  Node<Key, Value>* curr = root_;
+  while (true) {
+    // Go down the left side, saving each node to come back to
+    while (curr != NULL) {
+      if (depth == maxHeight) {
+        return false;
       }
-      else if (key > curr->getKey()) {
-        curr = curr->getRight();
+      stack[depth].node = curr;
+      stack[depth].leftDone = false;
+      depth++;
+      curr = curr->getLeft();
+    }
+
+    // h is the height of the subtree we just finished
+    int h = 0;
+    while (depth > 0) {
+      Frame& top = stack[depth - 1];
+      if (!top.leftDone) {
+        // Left subtree done, now do the right one
+        top.leftDone = true;
+        top.leftHeight = h;
+        curr = top.node->getRight();
+        break;
       }
-      else if (key == curr->getKey()) {
-        // Key already exists so return it as is
-        return curr;
+      // Both subtrees done, so check the difference is within -1 to 1
+      int check = top.leftHeight - h;
+      if (check < -1 || check > 1)  {
+        return false;
       }
+      h = std::max(top.leftHeight, h) + 1;
+      depth--;
+    }
+    if (depth == 0) {
+      return true;
     }
   }
-  
-  return NULL;
+}
+
+/**
+ * Returns the height of the tree, counting nodes.
+ */
+// Visits every node in preorder, climbing back up with the parent
+// pointers, so it needs no stack however deep the tree is
+template<typename Key, typename Value, typename Compare>
+int BinarySearchTree<Key, Value, Compare>::height() const
+{
+  if (root_ == NULL) {
+    return 0;
+  }
 
+  Node<Key, Value>* curr = root_;
+  int depth = 1;
+  int result = 1;
+  while (true) {
+    result = std::max(result, depth);
+    if (curr->getLeft() != NULL) {
+      curr = curr->getLeft();
+      depth++;
+    }
+    else if (curr->getRight() != NULL) {
+      curr = curr->getRight();
+      depth++;
+    }
+    else {
+      // A leaf, climb until we come up out of a left subtree
+      // whose parent still has a right subtree to visit
+      while (true) {
+        Node<Key, Value>* parent = curr->getParent();
+        if (parent == NULL) {
+          return result;
+        }
+        if (curr == parent->getLeft() && parent->getRight() != NULL) {
+          curr = parent->getRight();
+          break;
+        }
+        curr = parent;
+        depth--;
+      }
+    }
+  }
 }
 
+
+
 /**
- * Return true iff the BST is balanced.
+ * Returns the depth profile of the tree, with the root at depth 0.
  */
-// SIXTH: Working with recursively traversing BST tree
-// to check if left subtree height is within 1 of right subtree height
-// We should build another recursive helper function like the other
-// functions above
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare>
+DepthProfile BinarySearchTree<Key, Value, Compare>::depthProfile() const
 {
-  // Use the helper function by starting with the root_
-  // and checking every subtree traverse down
-  int h = 0;  // Stores the current height
-  return balance2(root_, h);
+  return ::depthProfile(root_);
+}
 
+/**
+ * Returns a copy of the counters. Without BST_STATS they are all 0.
+ */
+template<typename Key, typename Value, typename Compare>
+TreeStats BinarySearchTree<Key, Value, Compare>::stats() const
+{
+  TreeStats result;
+#ifdef BST_STATS
+  result.lookups = counters_.lookups.get();
+  result.lookupComparisons = counters_.lookupComparisons.get();
+  result.inserts = counters_.inserts.get();
+  result.insertComparisons = counters_.insertComparisons.get();
+  result.singleRotations = counters_.singleRotations.get();
+  result.doubleRotations = counters_.doubleRotations.get();
+  result.rebalances = counters_.rebalances.get();
+  result.rebalanceSteps = counters_.rebalanceSteps.get();
+  result.nodeSwaps = counters_.nodeSwaps.get();
+  result.maxDepth = counters_.maxDepth.get();
+#endif
+  return result;
 }
 
-// Helper function for the function above
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balance2(Node<Key, Value>* curr, int& height) const
+/**
+ * Sets every counter back to 0.
+ */
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::resetStats()
 {
-  // Base case checks if the node is null which means it is balanced
-  // The height would stay at 0
-  if (curr == NULL) {
-    height = 0;
-    return true;
+#ifdef BST_STATS
+  counters_.lookups.reset();
+  counters_.lookupComparisons.reset();
+  counters_.inserts.reset();
+  counters_.insertComparisons.reset();
+  counters_.singleRotations.reset();
+  counters_.doubleRotations.reset();
+  counters_.rebalances.reset();
+  counters_.rebalanceSteps.reset();
+  counters_.nodeSwaps.reset();
+  counters_.maxDepth.reset();
+#endif
+}
+
+#ifdef BST_STATS
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::countLookup(std::uint64_t depth) const
+{
+  counters_.lookups.add(1);
+  counters_.lookupComparisons.add(depth);
+  counters_.maxDepth.raiseTo(depth);
+}
+
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::countInsert(std::uint64_t depth, bool equalityCheck, bool added) const
+{
+  counters_.inserts.add(1);
+  counters_.insertComparisons.add(depth + equalityCheck);
+  // A new node goes one level below the deepest one we looked at
+  counters_.maxDepth.raiseTo(added ? depth + 1 : depth);
+}
+#endif
+
+/**
+ * Rebuilds the tree so every level but the last is full.
+ */
+// The Day-Stout-Warren algorithm: rotate the tree into a vine, a
+// chain of right children, and then fold the vine back up with rounds
+// of left rotations. Both steps are O(n) and need no stack
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::rebalance()
+{
+  rebuild(root_);
+  maxSize_ = pool_.size();
+}
+
+/**
+ * Turns the scapegoat style auto rebalance on with weight alpha, or off
+ * with 0. A bigger alpha lets the tree get deeper between rebuilds.
+ */
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::setAutoRebalance(double alpha)
+{
+  if (alpha != 0 && (alpha <= 0.5 || alpha >= 1)) {
+    throw std::invalid_argument("auto rebalance alpha must be in (0.5, 1)");
   }
+  rebalanceAlpha_ = alpha;
+  maxSize_ = pool_.size();
+}
 
-  // Recursive case checks left and right subtree heights to 
-  // ensure balance
-  int height1 = 0;
-  int height2 = 0;
-  bool left = balance2(curr->getLeft(), height1);
-  bool right = balance2(curr->getRight(), height2);
-  // The height is found by comparing left and right heights
-  if (height1 > height2)  {
-    height = height1 + 1;
+// Helper function for rebalance(), rebuilds the subtree at top in place
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::rebuild(Node<Key, Value>* top)
+{
+  if (top == NULL) {
+    return;
   }
-  else  {
-    height = height2 + 1;
+  Node<Key, Value>* parent = top->getParent();
+  bool onLeft = parent != NULL && parent->getLeft() == top;
+
+  // Tree to vine, a right rotation at every node with a left child
+  // puts one more node on the vine for good
+  std::size_t count = 0;
+  Node<Key, Value>* grand = parent;
+  Node<Key, Value>* curr = top;
+  while (curr != NULL) {
+    Node<Key, Value>* left = curr->getLeft();
+    if (left != NULL) {
+      curr->setLeft(left->getRight());
+      if (left->getRight() != NULL) {
+        left->getRight()->setParent(curr);
+      }
+      replaceChild(grand, curr, left);
+      left->setParent(grand);
+      left->setRight(curr);
+      curr->setParent(left);
+      curr = left;
+    }
+    else {
+      count++;
+      grand = curr;
+      curr = curr->getRight();
+    }
+  }
+
+  // Vine to tree, the first round only handles the nodes past the
+  // biggest perfect tree that fits, then each round halves the vine
+  std::size_t perfect = 1;
+  while (perfect <= (count - 1) / 2) {
+    perfect = perfect * 2 + 1;
+  }
+  compress(parent, onLeft, count - perfect);
+  while (perfect > 1) {
+    perfect /= 2;
+    compress(parent, onLeft, perfect);
+  }
+}
+
+// Helper function for rebuild(), does count left rotations at every
+// other node down the vine that hangs below parent
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::compress(
+    Node<Key, Value>* parent, bool onLeft, std::size_t count)
+{
+  Node<Key, Value>* grand = parent;
+  Node<Key, Value>* curr = root_;
+  if (parent != NULL) {
+    curr = onLeft ? parent->getLeft() : parent->getRight();
+  }
+  for (std::size_t i = 0; i < count; i++) {
+    Node<Key, Value>* right = curr->getRight();
+    curr->setRight(right->getLeft());
+    if (right->getLeft() != NULL) {
+      right->getLeft()->setParent(curr);
+    }
+    replaceChild(grand, curr, right);
+    right->setParent(grand);
+    right->setLeft(curr);
+    curr->setParent(right);
+    grand = right;
+    curr = right->getRight();
+  }
+}
+
+// Helper function that hangs newChild where oldChild was below parent,
+// or makes it the root when parent is NULL
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::replaceChild(
+    Node<Key, Value>* parent, Node<Key, Value>* oldChild, Node<Key, Value>* newChild)
+{
+  if (parent == NULL) {
+    root_ = newChild;
   }
-  // And then return the boolean value if the tree is balanced
-  // Basically if the difference is not within -1 to 1
-  int check = height1 - height2;
-  if (check < -1 || check > 1)  {
-    return false;
+  else if (parent->getLeft() == oldChild) {
+    parent->setLeft(newChild);
   }
-  return left && right;
+  else {
+    parent->setRight(newChild);
+  }
+}
 
+// Helper function that counts the nodes below top, walking in preorder
+// and climbing back up with the parent pointers like height()
+template<typename Key, typename Value, typename Compare>
+std::size_t BinarySearchTree<Key, Value, Compare>::subtreeSize(Node<Key, Value>* top) const
+{
+  if (top == NULL) {
+    return 0;
+  }
+  std::size_t count = 0;
+  Node<Key, Value>* curr = top;
+  while (true) {
+    count++;
+    if (curr->getLeft() != NULL) {
+      curr = curr->getLeft();
+    }
+    else if (curr->getRight() != NULL) {
+      curr = curr->getRight();
+    }
+    else {
+      while (true) {
+        if (curr == top) {
+          return count;
+        }
+        Node<Key, Value>* parent = curr->getParent();
+        if (curr == parent->getLeft() && parent->getRight() != NULL) {
+          curr = parent->getRight();
+          break;
+        }
+        curr = parent;
+      }
+    }
+  }
 }
 
+// Helper function for insertFrom(). A tree of n nodes whose subtrees
+// never hold more than alpha of their parent's nodes is at most
+// log_{1/alpha}(n) deep, so a new node below that has an ancestor
+// (the scapegoat) that breaks the rule. Rebuilding just that subtree
+// costs O(log n) amortized per insert
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::autoRebalance(Node<Key, Value>* added)
+{
+  std::size_t nodes = pool_.size();
+  maxSize_ = std::max(maxSize_, nodes);
+
+  int depth = 0;
+  for (Node<Key, Value>* curr = added->getParent(); curr != NULL; curr = curr->getParent()) {
+    depth++;
+  }
+  if (depth <= std::log(double(nodes)) / std::log(1 / rebalanceAlpha_)) {
+    return;
+  }
 
+  // Climb with the size of the subtree we came from, only the
+  // sibling subtrees have to be counted on the way up
+  Node<Key, Value>* curr = added;
+  std::size_t size = 1;
+  while (curr->getParent() != NULL) {
+    Node<Key, Value>* parent = curr->getParent();
+    Node<Key, Value>* sibling = parent->getLeft() == curr ? parent->getRight() : parent->getLeft();
+    std::size_t parentSize = size + 1 + subtreeSize(sibling);
+    if (size > rebalanceAlpha_ * parentSize) {
+      rebuild(parent);
+      return;
+    }
+    curr = parent;
+    size = parentSize;
+  }
+}
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    BST_STAT(counters_.nodeSwaps.add(1);)
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
@@ -0,0 +1,184 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+
+/**
+* A thread-safe wrapper around an AVLTree for many readers and one (or a
+* few) writers. Lookups take a shared lock, so readers run side by side
+* and only wait while a write is in progress. Writes take the lock
+* exclusively.
+*
+* Iterators would outlive the lock, so readers get copies of values, a
+* copy of the contents with snapshot(), or run code against the tree
+* under the shared lock with read(). Needs C++17 for std::shared_mutex.
+*/
+template <class Key, class Value, class Augment = NoAugment, class Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    typedef AVLTree<Key, Value, Augment, Compare> tree_type;
+
+    // Writers, these hold the lock exclusively
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    template<typename F>
+    void write(F f);
+
+    // Readers, these share the lock
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    Value operator[](const Key& key) const;
+    bool empty() const;
+    std::vector<std::pair<Key, Value> > snapshot() const;
+    template<typename F>
+    void read(F f) const;
+    // Counters of the tree inside, see BinarySearchTree::stats
+    TreeStats stats() const;
+
+private:
+    tree_type tree_;
+    mutable std::shared_mutex lock_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ------------------------------------------------------
+*/
+
+/**
+* Inserts (or overwrites) a pair, see AVLTree::insert.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void ConcurrentAVLTree<Key, Value, Augment, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  tree_.insert(keyValuePair);
+}
+
+/**
+* Removes a key if it is in the tree.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void ConcurrentAVLTree<Key, Value, Augment, Compare>::remove(const Key& key)
+{
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  tree_.remove(key);
+}
+
+/**
+* Removes every key.
+*/
+template<class Key, class Value, class Augment, class Compare>
+void ConcurrentAVLTree<Key, Value, Augment, Compare>::clear()
+{
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  tree_.clear();
+}
+
+/**
+* Calls f(tree) with the lock held exclusively, for updates that have to
+* happen together (e.g. insertBatch or a read-modify-write).
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Augment, Compare>::write(F f)
+{
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  f(tree_);
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is not in the tree.
+*/
+template<class Key, class Value, class Augment, class Compare>
+bool ConcurrentAVLTree<Key, Value, Augment, Compare>::find(const Key& key, Value& value) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  typename tree_type::const_iterator it = tree_.find(key);
+  if (it == tree_.end()) {
+    return false;
+  }
+  value = it->second;
+  return true;
+}
+
+/**
+* Returns true iff key is in the tree.
+*/
+template<class Key, class Value, class Augment, class Compare>
+bool ConcurrentAVLTree<Key, Value, Augment, Compare>::contains(const Key& key) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  return tree_.find(key) != tree_.end();
+}
+
+/**
+* @precondition The key exists in the map
+* Returns a copy of the value associated with the key
+*/
+template<class Key, class Value, class Augment, class Compare>
+Value ConcurrentAVLTree<Key, Value, Augment, Compare>::operator[](const Key& key) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  const tree_type& tree = tree_;
+  return tree[key];
+}
+
+/**
+* Returns true if tree is empty
+*/
+template<class Key, class Value, class Augment, class Compare>
+bool ConcurrentAVLTree<Key, Value, Augment, Compare>::empty() const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  return tree_.empty();
+}
+
+/**
+* Returns a copy of every pair in key order, all taken at one point in time.
+*/
+template<class Key, class Value, class Augment, class Compare>
+std::vector<std::pair<Key, Value> > ConcurrentAVLTree<Key, Value, Augment, Compare>::snapshot() const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  return std::vector<std::pair<Key, Value> >(tree_.begin(), tree_.end());
+}
+
+/**
+* Calls f(tree) with the lock shared, so f can iterate or run several
+* lookups against one consistent state. f must not change the tree.
+*/
+template<class Key, class Value, class Augment, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Augment, Compare>::read(F f) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  f(static_cast<const tree_type&>(tree_));
+}
+
+/**
+* Copies the counters without taking the lock, they are atomics so a
+* scrape never waits behind a writer.
+*/
+template<class Key, class Value, class Augment, class Compare>
+TreeStats ConcurrentAVLTree<Key, Value, Augment, Compare>::stats() const
+{
+  return tree_.stats();
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif
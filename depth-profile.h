@@ -0,0 +1,120 @@
+#ifndef DEPTH_PROFILE_H
+#define DEPTH_PROFILE_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+* How depthWalk gets at the children of a node. This works as is for
+* any node with public left and right pointers, like the Node in
+* equal-paths.h; bst.h specializes it for its own nodes.
+*/
+template<typename NodeT>
+struct NodeChildren
+{
+    static NodeT* left(const NodeT* node) { return node->left; }
+    static NodeT* right(const NodeT* node) { return node->right; }
+};
+
+/**
+* Visits every node below root in preorder, with the root at the given
+* depth, calling visit(node, depth, isLeaf). When visit returns false
+* on an inner node its children are skipped, and the walk stops there
+* and returns false. The right subtrees still to visit are kept on a
+* vector, so the depth of the tree is not limited by the call stack.
+*/
+template<typename NodeT, typename Visit>
+bool depthWalk(NodeT* root, int depth, Visit visit)
+{
+    if (root == NULL) {
+        return true;
+    }
+    std::vector<std::pair<NodeT*, int> > pending;
+    NodeT* curr = root;
+    while (true) {
+        NodeT* left = NodeChildren<NodeT>::left(curr);
+        NodeT* right = NodeChildren<NodeT>::right(curr);
+        bool leaf = left == NULL && right == NULL;
+        if (!visit(curr, depth, leaf)) {
+            return false;
+        }
+
+        if (leaf) {
+            if (pending.empty()) {
+                return true;
+            }
+            curr = pending.back().first;
+            depth = pending.back().second;
+            pending.pop_back();
+            continue;
+        }
+        // Go left first and come back for the right subtree
+        if (left != NULL) {
+            if (right != NULL) {
+                pending.push_back(std::make_pair(right, depth + 1));
+            }
+            curr = left;
+        }
+        else {
+            curr = right;
+        }
+        depth++;
+    }
+}
+
+/**
+* The shape of a tree by depth, with the root at depth 0. A balancing
+* monitor can tell from it how far the leaves have spread apart and
+* how full each level is.
+*/
+struct DepthProfile
+{
+    std::size_t nodes;
+    std::size_t leaves;
+    // Both -1 for an empty tree
+    int minLeafDepth;
+    int maxLeafDepth;
+    // Indexed by depth, so nodesAtDepth.size() is the height
+    std::vector<std::size_t> nodesAtDepth;
+    std::vector<std::size_t> leavesAtDepth;
+
+    DepthProfile() : nodes(0), leaves(0), minLeafDepth(-1), maxLeafDepth(-1) { }
+
+    // Same answer as equalPaths
+    bool equalPaths() const { return minLeafDepth == maxLeafDepth; }
+};
+
+/**
+* Builds the depth profile of the tree below root in one pass.
+*/
+template<typename NodeT>
+DepthProfile depthProfile(NodeT* root)
+{
+    DepthProfile profile;
+    depthWalk(root, 0, [&profile](NodeT*, int depth, bool leaf) {
+        std::size_t level = depth;
+        if (profile.nodesAtDepth.size() <= level) {
+            profile.nodesAtDepth.resize(level + 1, 0);
+        }
+        profile.nodesAtDepth[level]++;
+        profile.nodes++;
+        if (leaf) {
+            if (profile.leavesAtDepth.size() <= level) {
+                profile.leavesAtDepth.resize(level + 1, 0);
+            }
+            profile.leavesAtDepth[level]++;
+            profile.leaves++;
+            if (profile.minLeafDepth == -1 || depth < profile.minLeafDepth) {
+                profile.minLeafDepth = depth;
+            }
+            if (depth > profile.maxLeafDepth) {
+                profile.maxLeafDepth = depth;
+            }
+        }
+        return true;
+    });
+    return profile;
+}
+
+#endif
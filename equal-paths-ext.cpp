@@ -0,0 +1,125 @@
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "equal-paths-ext.h"
+using namespace std;
+
+// The depth all leaves must share, -1 until the first leaf sets it.
+// Threads race to set it, whoever loses compares against the winner
+typedef atomic<int> LeafDepth;
+
+// Checks one leaf against the shared depth, setting it if this is
+// the first leaf anyone has seen
+static bool checkLeaf(int depth, LeafDepth& leafDepth)
+{
+  int expected = -1;
+  if (leafDepth.compare_exchange_strong(expected, depth, memory_order_relaxed)) {
+    return true;
+  }
+  return expected == depth;
+}
+
+// Walks the subtree at start, whose root sits at the given depth.
+// Returns false on the first mismatch, or as soon as stop is set by
+// someone else
+static bool walk(Node* start, int depth, LeafDepth& leafDepth, const atomic<bool>* stop)
+{
+  // The leaf depth never changes once set, so keep our own copy
+  // and stop touching the shared one after that
+  int known = leafDepth.load(memory_order_relaxed);
+  size_t visited = 0;
+  return depthWalk(start, depth, [&](Node*, int length, bool leaf) {
+    // Looking at the flag every node would cost more than the walk
+    if (stop != NULL && (++visited & 1023) == 0 && stop->load(memory_order_relaxed)) {
+      return false;
+    }
+    if (leaf) {
+      if (known == -1) {
+        if (!checkLeaf(length, leafDepth)) {
+          return false;
+        }
+        known = length;
+        return true;
+      }
+      return length == known;
+    }
+    // An inner node at or below the leaf depth can only have deeper
+    // leaves under it, so there is no need to go down to them
+    return known == -1 || length < known;
+  });
+}
+
+bool equalPathsIterative(Node * root)
+{
+  if (root == NULL) {
+    return true;
+  }
+  LeafDepth leafDepth(-1);
+  return walk(root, 0, leafDepth, NULL);
+}
+
+bool equalPathsParallel(Node * root, unsigned threads)
+{
+  if (root == NULL) {
+    return true;
+  }
+  if (threads == 0) {
+    threads = thread::hardware_concurrency();
+  }
+  if (threads <= 1) {
+    return equalPathsIterative(root);
+  }
+
+  // Split the top of the tree into a few subtrees per thread so an
+  // uneven tree still spreads out. Leaves met on the way are checked
+  // here, the subtrees below the frontier are left to the threads
+  LeafDepth leafDepth(-1);
+  vector<pair<Node*, int> > frontier(1, make_pair(root, 0));
+  while (frontier.size() < 4 * threads) {
+    vector<pair<Node*, int> > next;
+    for (size_t i = 0; i < frontier.size(); i++) {
+      Node* curr = frontier[i].first;
+      int length = frontier[i].second;
+      if (curr->left == NULL && curr->right == NULL) {
+        if (!checkLeaf(length, leafDepth)) {
+          return false;
+        }
+        continue;
+      }
+      if (curr->left != NULL) {
+        next.push_back(make_pair(curr->left, length + 1));
+      }
+      if (curr->right != NULL) {
+        next.push_back(make_pair(curr->right, length + 1));
+      }
+    }
+    if (next.empty()) {
+      return true;
+    }
+    frontier.swap(next);
+  }
+
+  // Threads take subtrees off a shared counter until they run out or
+  // one of them finds a mismatch
+  atomic<bool> stop(false);
+  atomic<size_t> nextTask(0);
+  vector<thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.push_back(thread([&]() {
+      while (!stop.load(memory_order_relaxed)) {
+        size_t task = nextTask.fetch_add(1, memory_order_relaxed);
+        if (task >= frontier.size()) {
+          return;
+        }
+        if (!walk(frontier[task].first, frontier[task].second, leafDepth, &stop)) {
+          stop.store(true, memory_order_relaxed);
+        }
+      }
+    }));
+  }
+  for (unsigned t = 0; t < threads; t++) {
+    workers[t].join();
+  }
+  return !stop.load(memory_order_relaxed);
+}
@@ -0,0 +1,30 @@
+#ifndef EQUAL_PATHS_EXT_H
+#define EQUAL_PATHS_EXT_H
+
+#include "equal-paths.h"
+// depthProfile(root) gives the full picture (leaf depth range, leaves
+// and nodes per level) with the same walk as equalPathsIterative
+#include "depth-profile.h"
+
+/**
+ * @brief Same answer as equalPaths, but walks the tree with its own stack
+ *        instead of recursing, so a very deep tree cannot overflow the call
+ *        stack, and returns as soon as it finds two leaves at different
+ *        depths.
+ *
+ * @param root Pointer to the root of the tree to check for equal paths
+ */
+bool equalPathsIterative(Node * root);
+
+/**
+ * @brief Same answer as equalPaths, with the subtrees near the root split
+ *        across threads. Each thread walks its subtrees like
+ *        equalPathsIterative, and the first mismatch any of them finds
+ *        stops the others.
+ *
+ * @param root Pointer to the root of the tree to check for equal paths
+ * @param threads Number of threads to use, 0 for one per core
+ */
+bool equalPathsParallel(Node * root, unsigned threads = 0);
+
+#endif
@@ -47,7 +47,11 @@ bool helper(Node* curr, int length, int& fullLength, bool& first)
   }
 
   // Third is the recursive case, check the left and right of the tree
+  // No need to look at the right side once the left has a mismatch
   bool check1 = helper(curr->left, length + 1, fullLength, first);
+  if (!check1)  {
+    return false;
+  }
   bool check2 = helper(curr->right, length + 1, fullLength, first);
 
   // Return the results of recursing
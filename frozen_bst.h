@@ -0,0 +1,761 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/**
+* An immutable, pointer-free copy of a search tree for data that is
+* written once and then only read. The keys are kept as a perfect binary
+* tree laid out in van Emde Boas order: the top half of the levels comes
+* first, then each subtree hanging below it, each laid out the same way.
+* Any run of levels that fits in a cache line or page is then stored
+* together, whatever their sizes are, so a lookup touches about
+* log_B(n) blocks instead of one per level.
+*
+* A lookup finds the position of the next node from per-depth tables
+* (Brodal, Fagerberg and Jacob) instead of following child pointers.
+* The sorted pairs are kept apart in a plain array that iteration walks
+* and that lookups return iterators into.
+*
+* The perfect tree has 2^h - 1 slots for n keys. The slots past the
+* last key hold copies of the largest key, which keeps every lower bound
+* search correct and costs up to one extra copy of the keys.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class VebTree
+{
+public:
+    typedef std::pair<Key, Value> value_type;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    explicit VebTree(const Compare& comp = Compare());
+    // The range must be sorted by comp with no equal keys, as a tree's is
+    template<typename ForwardIt>
+    VebTree(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+    explicit VebTree(const BinarySearchTree<Key, Value, Compare>& tree);
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+    // Levels of the perfect tree the keys are stored in
+    int height() const;
+
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    Compare key_comp() const;
+
+protected:
+    // Lays out the subtree of the given height rooted at BFS index
+    // root (depth depth) at offset, and fills in the tables for it
+    void layout(std::size_t root, int depth, int height, std::size_t offset);
+    // In-order rank of the node with BFS index i at depth d
+    std::size_t rank(std::size_t i, int depth) const;
+    // Rank of the first key for which goLeft(key) holds, or size()
+    template<typename GoLeft>
+    std::size_t search(GoLeft goLeft) const;
+
+    // The pairs in key order
+    std::vector<value_type> items_;
+    // Keys of the perfect tree in van Emde Boas order
+    std::vector<Key> keys_;
+    // For each depth d > 1, the split where d starts the bottom trees:
+    // the depth of the top tree's root, the size of the top tree and
+    // the size of each bottom tree
+    std::vector<int> topDepth_;
+    std::vector<std::size_t> topSize_;
+    std::vector<std::size_t> bottomSize_;
+    int height_;
+    Compare comp_;
+};
+
+/**
+* Walks a batch of count probes down the first levels levels of an
+* Eytzinger array in lockstep, so their cache misses overlap instead of
+* coming one after another. index[i] starts at the root and ends at the
+* BFS index probe i reached. Any key type gets this scalar version;
+* with AVX2, 64 bit and 32 bit keys compare a whole vector of probes
+* per instruction instead.
+*/
+template<typename Key>
+struct EytzingerLanes
+{
+    static const int count = 16;
+    static void descend(const Key* keys, int levels, const Key* probes, std::size_t* index);
+};
+
+/**
+* A pointer-free copy of a tree with integer keys, kept as an Eytzinger
+* array: the keys of a complete binary tree in BFS order, the children
+* of index k at 2k and 2k + 1. A lookup is a short loop with no branch
+* on the comparison, k = 2k + (keys[k] < key), and since the 2^j
+* descendants j levels below k sit next to each other, one prefetch per
+* step fetches the cache line the search reaches j levels later. The
+* array starts on a cache line boundary for that to hold.
+*
+* The sorted pairs are kept apart as in VebTree, along with the rank of
+* each BFS index, and find_many looks up a whole batch of keys at a time.
+* Only std::less is supported, which is what the branchless compare and
+* the vector compares rely on.
+*/
+template <typename Key, typename Value>
+class EytzingerTree
+{
+public:
+    typedef std::pair<Key, Value> value_type;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    EytzingerTree();
+    // The range must be sorted with no equal keys, as a tree's is
+    template<typename ForwardIt>
+    EytzingerTree(ForwardIt first, ForwardIt last, const std::less<Key>& comp = std::less<Key>());
+    explicit EytzingerTree(const BinarySearchTree<Key, Value, std::less<Key> >& tree);
+    // A copy lays its keys out again, the new array may be aligned differently
+    EytzingerTree(const EytzingerTree& other);
+    EytzingerTree(EytzingerTree&& other) = default;
+    EytzingerTree& operator=(const EytzingerTree& other);
+    EytzingerTree& operator=(EytzingerTree&& other) = default;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    std::size_t size() const;
+    bool empty() const;
+    // Levels of the complete tree the keys are stored in
+    int height() const;
+
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    std::less<Key> key_comp() const;
+
+    // Writes find(key) for every key in [first, last) to out
+    template<typename InputIt, typename OutputIt>
+    OutputIt find_many(InputIt first, InputIt last, OutputIt out) const;
+
+protected:
+    // Keys per 64 byte cache line
+    static const std::size_t LINE_KEYS = 64 / sizeof(Key);
+
+    // Fills keys and ranks from items_
+    void build();
+    // Gives BFS index k and its subtree the items from rank i on, and
+    // returns the rank after them
+    std::size_t fill(Key* keys, std::size_t k, std::size_t i);
+    const Key* keys() const;
+    // BFS index of the first key not less than key (greater than key if
+    // Upper), or 0 if there is none
+    template<bool Upper>
+    std::size_t search(const Key& key) const;
+    const_iterator at(std::size_t k) const;
+
+    // The pairs in key order
+    std::vector<value_type> items_;
+    // The keys in BFS order from index 1 of the aligned array, which
+    // starts offset_ keys into storage_
+    std::vector<Key> storage_;
+    std::size_t offset_;
+    // Rank in items_ of the key at each BFS index
+    std::vector<std::size_t> rank_;
+    // Levels that are complete, every search goes through all of them
+    int levels_;
+};
+
+/**
+* The read-only snapshot of a tree: a VebTree in general, and an
+* EytzingerTree for 64 bit and 32 bit integer keys in their natural order.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree : public VebTree<Key, Value, Compare>
+{
+public:
+    using VebTree<Key, Value, Compare>::VebTree;
+};
+
+template <typename Value>
+class FrozenTree<std::uint64_t, Value, std::less<std::uint64_t> > :
+    public EytzingerTree<std::uint64_t, Value>
+{
+public:
+    using EytzingerTree<std::uint64_t, Value>::EytzingerTree;
+};
+
+template <typename Value>
+class FrozenTree<std::int32_t, Value, std::less<std::int32_t> > :
+    public EytzingerTree<std::int32_t, Value>
+{
+public:
+    using EytzingerTree<std::int32_t, Value>::EytzingerTree;
+};
+
+/**
+* Makes a frozen copy of a BinarySearchTree or AVLTree.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare> freeze(const BinarySearchTree<Key, Value, Compare>& tree)
+{
+    return FrozenTree<Key, Value, Compare>(tree);
+}
+
+/*
+  --------------------------------------------
+  Begin implementations for the VebTree class.
+  --------------------------------------------
+*/
+
+/**
+* Default constructor, makes an empty tree.
+*/
+template<typename Key, typename Value, typename Compare>
+VebTree<Key, Value, Compare>::VebTree(const Compare& comp) :
+    height_(0),
+    comp_(comp)
+{
+}
+
+/**
+* Copies a sorted range and lays its keys out.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+VebTree<Key, Value, Compare>::VebTree(ForwardIt first, ForwardIt last, const Compare& comp) :
+    items_(first, last),
+    height_(0),
+    comp_(comp)
+{
+    if (items_.empty()) {
+        return;
+    }
+    while ((std::size_t(1) << height_) - 1 < items_.size()) {
+        height_++;
+    }
+    std::size_t slots = (std::size_t(1) << height_) - 1;
+    keys_.assign(slots, items_.back().first);
+    topDepth_.assign(height_ + 1, 0);
+    topSize_.assign(height_ + 1, 0);
+    bottomSize_.assign(height_ + 1, 0);
+    layout(1, 1, height_, 0);
+}
+
+/**
+* Copies every pair of a tree, which are already in order.
+*/
+template<typename Key, typename Value, typename Compare>
+VebTree<Key, Value, Compare>::VebTree(const BinarySearchTree<Key, Value, Compare>& tree) :
+    VebTree(tree.begin(), tree.end(), tree.key_comp())
+{
+}
+
+// Puts the key of every node of the subtree in its slot. The top half of
+// the levels goes first, then the bottom trees from left to right
+template<typename Key, typename Value, typename Compare>
+void VebTree<Key, Value, Compare>::layout(std::size_t root, int depth, int height, std::size_t offset)
+{
+    if (height == 1) {
+        std::size_t r = rank(root, depth);
+        if (r < items_.size()) {
+            keys_[offset] = items_[r].first;
+        }
+        return;
+    }
+
+    int top = height / 2;
+    int bottom = height - top;
+    std::size_t topSize = (std::size_t(1) << top) - 1;
+    std::size_t bottomSize = (std::size_t(1) << bottom) - 1;
+    // Every split of this shape at this depth gives the same numbers,
+    // so writing them again from each subtree is harmless
+    topDepth_[depth + top] = depth;
+    topSize_[depth + top] = topSize;
+    bottomSize_[depth + top] = bottomSize;
+
+    layout(root, depth, top, offset);
+    std::size_t firstBottom = root << top;
+    for (std::size_t j = 0; j <= topSize; j++) {
+        layout(firstBottom + j, depth + top, bottom, offset + topSize + j * bottomSize);
+    }
+}
+
+// Node i (root 1) at depth d is the ((i - 2^(d-1)) * 2 + 1)-th of the
+// 2^(d) evenly spaced slots at its level, each 2^(h-d) ranks wide
+template<typename Key, typename Value, typename Compare>
+std::size_t VebTree<Key, Value, Compare>::rank(std::size_t i, int depth) const
+{
+    return ((((i << 1) - (std::size_t(1) << depth)) + 1) << (height_ - depth)) - 1;
+}
+
+// Goes down the perfect tree once. The node at the next depth sits in
+// the bottom tree picked by the low bits of its BFS index, right after
+// the top tree that depth belongs to
+template<typename Key, typename Value, typename Compare>
+template<typename GoLeft>
+std::size_t VebTree<Key, Value, Compare>::search(GoLeft goLeft) const
+{
+    std::size_t result = items_.size();
+    if (height_ == 0) {
+        return result;
+    }
+
+    std::size_t pos[64];
+    pos[1] = 0;
+    std::size_t i = 1;
+    for (int d = 1; d <= height_; d++) {
+        if (goLeft(keys_[pos[d]])) {
+            result = rank(i, d);
+            i = i << 1;
+        }
+        else {
+            i = (i << 1) | 1;
+        }
+        if (d < height_) {
+            int next = d + 1;
+            pos[next] = pos[topDepth_[next]] + topSize_[next] + (i & topSize_[next]) * bottomSize_[next];
+        }
+    }
+    // Padding slots copy the largest key, so they never win over it
+    return result < items_.size() ? result : items_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename VebTree<Key, Value, Compare>::const_iterator
+VebTree<Key, Value, Compare>::begin() const
+{
+    return items_.begin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename VebTree<Key, Value, Compare>::const_iterator
+VebTree<Key, Value, Compare>::end() const
+{
+    return items_.end();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t VebTree<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool VebTree<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+template<typename Key, typename Value, typename Compare>
+int VebTree<Key, Value, Compare>::height() const
+{
+    return height_;
+}
+
+/**
+* Returns an iterator to the pair with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename VebTree<Key, Value, Compare>::const_iterator
+VebTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it = lower_bound(key);
+    if (it != end() && !comp_(key, it->first)) {
+        return it;
+    }
+    return end();
+}
+
+/**
+* Returns an iterator to the first pair whose key is not less than key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename VebTree<Key, Value, Compare>::const_iterator
+VebTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    const Compare& comp = comp_;
+    return begin() + search([&](const Key& k) { return !comp(k, key); });
+}
+
+/**
+* Returns an iterator to the first pair whose key is greater than key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename VebTree<Key, Value, Compare>::const_iterator
+VebTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    const Compare& comp = comp_;
+    return begin() + search([&](const Key& k) { return comp(key, k); });
+}
+
+/**
+* @precondition The key exists in the tree
+* Returns the value associated with the key
+*/
+template<typename Key, typename Value, typename Compare>
+Value const & VebTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Compare>
+Compare VebTree<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/*
+  ------------------------------------------
+  End implementations for the VebTree class.
+  ------------------------------------------
+*/
+
+/*
+  --------------------------------------------------
+  Begin implementations for the EytzingerTree class.
+  --------------------------------------------------
+*/
+
+// Drops the trailing 1 bits of k and the 0 bit before them, which takes a
+// search that ran off the bottom back up to the last node it went left at
+inline std::size_t eytzingerResult(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> __builtin_ffsll(~static_cast<unsigned long long>(k));
+#else
+    while (k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+template<typename Key>
+void EytzingerLanes<Key>::descend(const Key* keys, int levels, const Key* probes, std::size_t* index)
+{
+    const std::size_t line = 64 / sizeof(Key);
+    for (int i = 0; i < count; i++) {
+        index[i] = 1;
+    }
+    for (int level = 0; level < levels; level++) {
+        for (int i = 0; i < count; i++) {
+            BST_PREFETCH(keys + index[i] * line);
+            index[i] = 2 * index[i] + (keys[index[i]] < probes[i]);
+        }
+    }
+}
+
+#ifdef __AVX2__
+// Four probes per vector. AVX2 only compares signed 64 bit numbers, so
+// flipping the top bit of both sides first gives the unsigned order
+template<>
+inline void EytzingerLanes<std::uint64_t>::descend(const std::uint64_t* keys, int levels,
+                                                   const std::uint64_t* probes, std::size_t* index)
+{
+    const int vectors = count / 4;
+    const long long* base = reinterpret_cast<const long long*>(keys);
+    const __m256i flip = _mm256_set1_epi64x(static_cast<long long>(1ULL << 63));
+    __m256i probe[vectors];
+    __m256i k[vectors];
+    for (int v = 0; v < vectors; v++) {
+        probe[v] = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(probes + 4 * v)), flip);
+        k[v] = _mm256_set1_epi64x(1);
+    }
+    for (int level = 0; level < levels; level++) {
+        for (int v = 0; v < vectors; v++) {
+            __m256i nodeKeys = _mm256_xor_si256(_mm256_i64gather_epi64(base, k[v], 8), flip);
+            // A lane where keys[k] < probe compares to -1, so subtracting
+            // the comparison from 2k goes right there
+            k[v] = _mm256_sub_epi64(_mm256_add_epi64(k[v], k[v]), _mm256_cmpgt_epi64(probe[v], nodeKeys));
+        }
+    }
+    for (int v = 0; v < vectors; v++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(index + 4 * v), k[v]);
+    }
+}
+
+// Eight probes per vector. The indices are 32 bit as well, which holds
+// them for any tree of fewer than 2^30 keys
+template<>
+inline void EytzingerLanes<std::int32_t>::descend(const std::int32_t* keys, int levels,
+                                                  const std::int32_t* probes, std::size_t* index)
+{
+    const int vectors = count / 8;
+    const int* base = reinterpret_cast<const int*>(keys);
+    __m256i probe[vectors];
+    __m256i k[vectors];
+    for (int v = 0; v < vectors; v++) {
+        probe[v] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(probes + 8 * v));
+        k[v] = _mm256_set1_epi32(1);
+    }
+    for (int level = 0; level < levels; level++) {
+        for (int v = 0; v < vectors; v++) {
+            __m256i nodeKeys = _mm256_i32gather_epi32(base, k[v], 4);
+            k[v] = _mm256_sub_epi32(_mm256_add_epi32(k[v], k[v]), _mm256_cmpgt_epi32(probe[v], nodeKeys));
+        }
+    }
+    std::int32_t reached[count];
+    for (int v = 0; v < vectors; v++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(reached + 8 * v), k[v]);
+    }
+    for (int i = 0; i < count; i++) {
+        index[i] = static_cast<std::size_t>(reached[i]);
+    }
+}
+#endif
+
+/**
+* Default constructor, makes an empty tree.
+*/
+template<typename Key, typename Value>
+EytzingerTree<Key, Value>::EytzingerTree() :
+    offset_(0),
+    levels_(0)
+{
+    build();
+}
+
+/**
+* Copies a sorted range and lays its keys out.
+*/
+template<typename Key, typename Value>
+template<typename ForwardIt>
+EytzingerTree<Key, Value>::EytzingerTree(ForwardIt first, ForwardIt last, const std::less<Key>&) :
+    items_(first, last),
+    offset_(0),
+    levels_(0)
+{
+    build();
+}
+
+/**
+* Copies every pair of a tree, which are already in order.
+*/
+template<typename Key, typename Value>
+EytzingerTree<Key, Value>::EytzingerTree(const BinarySearchTree<Key, Value, std::less<Key> >& tree) :
+    EytzingerTree(tree.begin(), tree.end())
+{
+}
+
+template<typename Key, typename Value>
+EytzingerTree<Key, Value>::EytzingerTree(const EytzingerTree& other) :
+    items_(other.items_),
+    offset_(0),
+    levels_(0)
+{
+    build();
+}
+
+template<typename Key, typename Value>
+EytzingerTree<Key, Value>& EytzingerTree<Key, Value>::operator=(const EytzingerTree& other)
+{
+    if (this != &other) {
+        items_ = other.items_;
+        build();
+    }
+    return *this;
+}
+
+template<typename Key, typename Value>
+void EytzingerTree<Key, Value>::build()
+{
+    std::size_t n = items_.size();
+    levels_ = 0;
+    while ((std::size_t(1) << (levels_ + 1)) - 1 <= n) {
+        levels_++;
+    }
+    // Room for index 0 to n after moving the start up to a line boundary
+    storage_.assign(n + LINE_KEYS, Key());
+    std::size_t misalignment = reinterpret_cast<std::uintptr_t>(storage_.data()) / sizeof(Key) % LINE_KEYS;
+    offset_ = (LINE_KEYS - misalignment) % LINE_KEYS;
+    rank_.assign(n + 1, 0);
+    fill(storage_.data() + offset_, 1, 0);
+}
+
+// An in-order walk of the implicit tree hands out the ranks in order
+template<typename Key, typename Value>
+std::size_t EytzingerTree<Key, Value>::fill(Key* keys, std::size_t k, std::size_t i)
+{
+    if (k <= items_.size()) {
+        i = fill(keys, 2 * k, i);
+        keys[k] = items_[i].first;
+        rank_[k] = i;
+        i = fill(keys, 2 * k + 1, i + 1);
+    }
+    return i;
+}
+
+template<typename Key, typename Value>
+const Key* EytzingerTree<Key, Value>::keys() const
+{
+    return storage_.data() + offset_;
+}
+
+// Goes right past every key that is less than key (or equal, for Upper)
+// until it runs off the bottom, prefetching the line the search will be
+// on log2(LINE_KEYS) levels further down
+template<typename Key, typename Value>
+template<bool Upper>
+std::size_t EytzingerTree<Key, Value>::search(const Key& key) const
+{
+    const Key* keys = this->keys();
+    std::size_t n = items_.size();
+    std::size_t k = 1;
+    while (k <= n) {
+        BST_PREFETCH(keys + k * LINE_KEYS);
+        k = 2 * k + (Upper ? !(key < keys[k]) : keys[k] < key);
+    }
+    return eytzingerResult(k);
+}
+
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::at(std::size_t k) const
+{
+    return k == 0 ? end() : begin() + rank_[k];
+}
+
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::begin() const
+{
+    return items_.begin();
+}
+
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::end() const
+{
+    return items_.end();
+}
+
+template<typename Key, typename Value>
+std::size_t EytzingerTree<Key, Value>::size() const
+{
+    return items_.size();
+}
+
+template<typename Key, typename Value>
+bool EytzingerTree<Key, Value>::empty() const
+{
+    return items_.empty();
+}
+
+template<typename Key, typename Value>
+int EytzingerTree<Key, Value>::height() const
+{
+    return (std::size_t(1) << levels_) - 1 < items_.size() ? levels_ + 1 : levels_;
+}
+
+/**
+* Returns an iterator to the pair with the given key, or end().
+*/
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::find(const Key& key) const
+{
+    std::size_t k = search<false>(key);
+    if (k != 0 && !(key < keys()[k])) {
+        return at(k);
+    }
+    return end();
+}
+
+/**
+* Returns an iterator to the first pair whose key is not less than key.
+*/
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::lower_bound(const Key& key) const
+{
+    return at(search<false>(key));
+}
+
+/**
+* Returns an iterator to the first pair whose key is greater than key.
+*/
+template<typename Key, typename Value>
+typename EytzingerTree<Key, Value>::const_iterator
+EytzingerTree<Key, Value>::upper_bound(const Key& key) const
+{
+    return at(search<true>(key));
+}
+
+/**
+* @precondition The key exists in the tree
+* Returns the value associated with the key
+*/
+template<typename Key, typename Value>
+Value const & EytzingerTree<Key, Value>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if (it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value>
+std::less<Key> EytzingerTree<Key, Value>::key_comp() const
+{
+    return std::less<Key>();
+}
+
+/**
+* Looks the keys up EytzingerLanes::count at a time. Each batch goes
+* down the complete levels together, then every probe takes the last,
+* partial level on its own.
+*/
+template<typename Key, typename Value>
+template<typename InputIt, typename OutputIt>
+OutputIt EytzingerTree<Key, Value>::find_many(InputIt first, InputIt last, OutputIt out) const
+{
+    typedef EytzingerLanes<Key> Lanes;
+    const Key* keys = this->keys();
+    std::size_t n = items_.size();
+    Key probes[Lanes::count];
+    std::size_t index[Lanes::count];
+    // The vector indices of 32 bit keys only reach 2^31, past that the
+    // probes all go down one at a time
+    bool lockstep = sizeof(Key) > 4 || n < (std::size_t(1) << 30);
+
+    while (first != last) {
+        int count = 0;
+        for (; count < Lanes::count && first != last; ++first) {
+            probes[count++] = *first;
+        }
+        // A short last batch repeats its first probe in the unused lanes
+        for (int i = count; i < Lanes::count; i++) {
+            probes[i] = probes[0];
+        }
+        Lanes::descend(keys, lockstep ? levels_ : 0, probes, index);
+        for (int i = 0; i < count; i++) {
+            std::size_t k = index[i];
+            while (k <= n) {
+                k = 2 * k + (keys[k] < probes[i]);
+            }
+            k = eytzingerResult(k);
+            *out = (k != 0 && !(probes[i] < keys[k])) ? at(k) : end();
+            ++out;
+        }
+    }
+    return out;
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the EytzingerTree class.
+  ------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+/**
+* A fixed-slot arena used by the search trees to store their nodes.
+* Memory is carved out of large slabs so that nodes created together
+* sit next to each other, freed slots are kept on an intrusive free
+* list for O(1) reuse, and release() hands every slab back at once.
+*
+* The pool only manages raw memory; constructing and destroying the
+* objects placed in a slot is up to the caller.
+*/
+class NodePool
+{
+public:
+    NodePool(std::size_t slotSize, std::size_t slotAlign);
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* slot);
+    void release();
+    std::size_t size() const;
+
+private:
+    // Slots are not copyable memory, so neither is the pool
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    void grow();
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    std::vector<void*> slabs_;
+    FreeSlot* free_;
+    char* cursor_;
+    char* limit_;
+    std::size_t slotSize_;
+    std::size_t slotAlign_;
+    std::size_t slabSlots_;
+    std::size_t live_;
+};
+
+/*
+  ---------------------------------------------
+  Begin implementations for the NodePool class.
+  ---------------------------------------------
+*/
+
+// The first slab is small so tiny trees stay cheap, later slabs
+// double up to a cap so big trees get long contiguous runs
+static const std::size_t NODE_POOL_FIRST_SLAB = 32;
+static const std::size_t NODE_POOL_MAX_SLAB = 65536;
+
+/**
+* Creates an empty pool whose slots can each hold an object of
+* slotSize bytes aligned to slotAlign.
+*/
+inline NodePool::NodePool(std::size_t slotSize, std::size_t slotAlign) :
+    free_(NULL),
+    cursor_(NULL),
+    limit_(NULL),
+    slabSlots_(NODE_POOL_FIRST_SLAB),
+    live_(0)
+{
+  // A free slot has to be able to hold the free list link
+  if (slotSize < sizeof(FreeSlot)) {
+    slotSize = sizeof(FreeSlot);
+  }
+  if (slotAlign < alignof(FreeSlot)) {
+    slotAlign = alignof(FreeSlot);
+  }
+  // Round the slot size up so that every slot in a slab stays aligned
+  slotSize_ = (slotSize + slotAlign - 1) / slotAlign * slotAlign;
+  slotAlign_ = slotAlign;
+}
+
+/**
+* Destructor, which gives back every slab. Objects still living in
+* the pool are not destroyed.
+*/
+inline NodePool::~NodePool()
+{
+  release();
+}
+
+/**
+* Returns a slot, reusing the most recently freed one if there is one.
+*/
+inline void* NodePool::allocate()
+{
+  live_++;
+  if (free_ != NULL) {
+    FreeSlot* slot = free_;
+    free_ = slot->next;
+    return slot;
+  }
+  if (cursor_ == limit_) {
+    grow();
+  }
+  void* slot = cursor_;
+  cursor_ += slotSize_;
+  return slot;
+}
+
+/**
+* Puts a slot back on the free list. The object in it must already
+* have been destroyed.
+*/
+inline void NodePool::deallocate(void* slot)
+{
+  FreeSlot* freed = static_cast<FreeSlot*>(slot);
+  freed->next = free_;
+  free_ = freed;
+  live_--;
+}
+
+/**
+* Frees every slab in one go, without visiting the slots.
+*/
+inline void NodePool::release()
+{
+  for (std::size_t i = 0; i < slabs_.size(); i++) {
+    std::free(slabs_[i]);
+  }
+  slabs_.clear();
+  free_ = NULL;
+  cursor_ = NULL;
+  limit_ = NULL;
+  slabSlots_ = NODE_POOL_FIRST_SLAB;
+  live_ = 0;
+}
+
+/**
+* Returns the number of slots currently handed out.
+*/
+inline std::size_t NodePool::size() const
+{
+  return live_;
+}
+
+// Helper for allocate() that adds a new slab to carve slots from
+inline void NodePool::grow()
+{
+  // malloc only aligns for the fundamental types, so an over-aligned
+  // node type gets a slab with room to move its start up to slotAlign_.
+  // slabs_ keeps what malloc returned, for free. Make room in the slab
+  // list first so a failed push_back can't leak the new slab
+  std::size_t padding = slotAlign_ > alignof(std::max_align_t) ? slotAlign_ - 1 : 0;
+  slabs_.reserve(slabs_.size() + 1);
+  char* slab = static_cast<char*>(std::malloc(slotSize_ * slabSlots_ + padding));
+  if (slab == NULL) {
+    throw std::bad_alloc();
+  }
+  slabs_.push_back(slab);
+  std::size_t misalignment = reinterpret_cast<std::uintptr_t>(slab) % slotAlign_;
+  cursor_ = misalignment == 0 ? slab : slab + (slotAlign_ - misalignment);
+  limit_ = cursor_ + slotSize_ * slabSlots_;
+  if (slabSlots_ < NODE_POOL_MAX_SLAB) {
+    slabSlots_ *= 2;
+  }
+}
+
+/*
+  -------------------------------------------
+  End implementations for the NodePool class.
+  -------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,567 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* A node of a PersistentAVLTree. Nodes never change once built and are
+* shared between every version of the tree that contains them, so there
+* is no parent pointer (a shared node has a different parent in each
+* version). Children are reference counted and a node goes away with the
+* last version that uses it.
+*/
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    typedef std::shared_ptr<const PersistentAVLNode<Key, Value> > ptr;
+
+    PersistentAVLNode(const std::pair<const Key, Value>& item, const ptr& left, const ptr& right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    const ptr& getLeft() const;
+    const ptr& getRight() const;
+    int getHeight() const;
+
+    static int height(const ptr& node);
+
+protected:
+    std::pair<const Key, Value> item_;
+    ptr left_;
+    ptr right_;
+    int height_;
+};
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  ------------------------------------------------------
+*/
+
+/**
+* Explicit constructor, the height follows from the children.
+*/
+template<typename Key, typename Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(
+    const std::pair<const Key, Value>& item, const ptr& left, const ptr& right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(std::max(height(left), height(right)) + 1)
+{
+
+}
+
+/**
+* A getter for the item.
+*/
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+/**
+* A getter for the key.
+*/
+template<typename Key, typename Value>
+const Key& PersistentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+/**
+* A getter for the value.
+*/
+template<typename Key, typename Value>
+const Value& PersistentAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+/**
+* A getter for the left child.
+*/
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::ptr& PersistentAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+/**
+* A getter for the right child.
+*/
+template<typename Key, typename Value>
+const typename PersistentAVLNode<Key, Value>::ptr& PersistentAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* A getter for the height of the node's subtree (a leaf has height 1).
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+/**
+* Returns the height of a possibly empty subtree.
+*/
+template<typename Key, typename Value>
+int PersistentAVLNode<Key, Value>::height(const ptr& node)
+{
+    return node ? node->height_ : 0;
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* A copy-on-write AVL tree. insert and remove never change a node, they
+* build new copies of the O(log n) nodes on the path to the change and
+* share every other node with the old version. That makes snapshot() an
+* O(1) copy of the root, and a snapshot stays the same however the tree
+* changes afterwards.
+*
+* One writer thread may update the tree while any number of reader threads
+* call snapshot() on it; the root is published and read atomically. The
+* snapshots are then read without any locking. Apart from snapshot(), a
+* tree that is being written must only be used by its writer.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> node_type;
+    typedef typename node_type::ptr node_ptr;
+
+    /**
+    * An iterator over a version of the tree, in key order. It keeps the
+    * path from the root on a stack since nodes have no parent pointer.
+    * The nodes are kept alive by the tree (or snapshot) it came from.
+    */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        void pushLeft(const node_type* node);
+        std::vector<const node_type*> stack_;
+    };
+
+    PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    PersistentAVLTree<Key, Value> snapshot() const;
+
+    bool empty() const;
+    int height() const;
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+
+protected:
+    // Path copying helpers, each returns the root of the new version
+    // of the subtree and leaves the old one untouched
+    static node_ptr makeNode(const std::pair<const Key, Value>& item, const node_ptr& left, const node_ptr& right);
+    static node_ptr balance(const std::pair<const Key, Value>& item, const node_ptr& left, const node_ptr& right);
+    static node_ptr insertHelper(const node_ptr& curr, const std::pair<const Key, Value>& keyValuePair);
+    static node_ptr removeHelper(const node_ptr& curr, const Key& key);
+    static node_ptr removeLargest(const node_ptr& curr, const node_type*& largest);
+
+    node_ptr root_;
+};
+
+/*
+  -----------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::iterator class.
+  -----------------------------------------------------------------
+*/
+
+/**
+* A default constructor that makes an end iterator.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::iterator::iterator()
+{
+}
+
+/**
+* Provides access to the item.
+*/
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+  return stack_.back()->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<typename Key, typename Value>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+  return &(stack_.back()->getItem());
+}
+
+/**
+* Two iterators are equal when they are at the same node (or both at the end).
+*/
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+  if (stack_.empty() || rhs.stack_.empty()) {
+    return stack_.empty() && rhs.stack_.empty();
+  }
+  return stack_.back() == rhs.stack_.back();
+}
+
+/**
+* The opposite of operator==.
+*/
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+  return !(*this == rhs);
+}
+
+/**
+* Advances to the next key. The stack holds the current node and the
+* ancestors still waiting to be visited, so the next node is either the
+* leftmost node of the right subtree or the next ancestor on the stack.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator&
+PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+  if (stack_.empty()) {
+    return *this;
+  }
+  const node_type* curr = stack_.back();
+  stack_.pop_back();
+  pushLeft(curr->getRight().get());
+  return *this;
+}
+
+/**
+* Advances the iterator and returns where it was.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::iterator::operator++(int)
+{
+  iterator old = *this;
+  ++(*this);
+  return old;
+}
+
+// Helper that pushes node and its chain of left children
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeft(const node_type* node)
+{
+  while (node != NULL) {
+    stack_.push_back(node);
+    node = node->getLeft().get();
+  }
+}
+
+/*
+  ---------------------------------------------------------------
+  End implementations for the PersistentAVLTree::iterator class.
+  ---------------------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ------------------------------------------------------
+*/
+
+/**
+* Default constructor, which makes an empty tree.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree()
+{
+}
+
+/**
+* Inserts a pair, or replaces the value if the key is already there.
+* Existing snapshots keep seeing the old contents.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+  std::atomic_store(&root_, insertHelper(root_, keyValuePair));
+}
+
+/**
+* Removes a key if it is in the tree. Existing snapshots keep it.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+  node_ptr root = removeHelper(root_, key);
+  if (root != root_) {
+    std::atomic_store(&root_, root);
+  }
+}
+
+/**
+* Empties this version of the tree. Nodes still used by a snapshot stay.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+  std::atomic_store(&root_, node_ptr());
+}
+
+/**
+* Returns the current version of the tree in O(1). It shares every node
+* with this tree and is not affected by later inserts or removes.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value> PersistentAVLTree<Key, Value>::snapshot() const
+{
+  PersistentAVLTree<Key, Value> copy;
+  copy.root_ = std::atomic_load(&root_);
+  return copy;
+}
+
+/**
+* Returns true if tree is empty
+*/
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+  return !root_;
+}
+
+/**
+* Returns the height of the tree (0 when empty), in O(1).
+*/
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::height() const
+{
+  return node_type::height(root_);
+}
+
+/**
+* Returns an iterator to the smallest key.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::begin() const
+{
+  iterator it;
+  it.pushLeft(root_.get());
+  return it;
+}
+
+/**
+* Returns the end iterator.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::end() const
+{
+  return iterator();
+}
+
+/**
+* Returns an iterator to the given key, or the end iterator. The stack
+* keeps the ancestors we went left at, they are the ones still to visit.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+  iterator it;
+  const node_type* curr = root_.get();
+  while (curr != NULL) {
+    if (key < curr->getKey()) {
+      it.stack_.push_back(curr);
+      curr = curr->getLeft().get();
+    }
+    else if (curr->getKey() < key) {
+      curr = curr->getRight().get();
+    }
+    else {
+      it.stack_.push_back(curr);
+      return it;
+    }
+  }
+  return end();
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key
+*/
+template<typename Key, typename Value>
+const Value& PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+  const node_type* curr = root_.get();
+  while (curr != NULL) {
+    if (key < curr->getKey()) {
+      curr = curr->getLeft().get();
+    }
+    else if (curr->getKey() < key) {
+      curr = curr->getRight().get();
+    }
+    else {
+      return curr->getValue();
+    }
+  }
+  throw std::out_of_range("Invalid key");
+}
+
+// Helper that allocates a node and its reference count together
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::node_ptr PersistentAVLTree<Key, Value>::makeNode(
+    const std::pair<const Key, Value>& item, const node_ptr& left, const node_ptr& right)
+{
+  return std::make_shared<const node_type>(item, left, right);
+}
+
+// Helper that builds a node over two subtrees whose heights differ by at
+// most 2, doing the single or double rotation that brings them back within
+// 1. It is the same case analysis as AVLTree::insertHelper, but working on
+// heights since the rotated nodes are built fresh instead of relinked.
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::node_ptr PersistentAVLTree<Key, Value>::balance(
+    const std::pair<const Key, Value>& item, const node_ptr& left, const node_ptr& right)
+{
+  int leftHeight = node_type::height(left);
+  int rightHeight = node_type::height(right);
+
+  if (leftHeight > rightHeight + 1) {
+    const node_ptr& a = left->getLeft();
+    const node_ptr& b = left->getRight();
+    if (node_type::height(a) >= node_type::height(b)) {
+      // Single right rotation
+      return makeNode(left->getItem(), a, makeNode(item, b, right));
+    }
+    // Left-right double rotation
+    return makeNode(b->getItem(), makeNode(left->getItem(), a, b->getLeft()),
+                    makeNode(item, b->getRight(), right));
+  }
+  if (rightHeight > leftHeight + 1) {
+    const node_ptr& a = right->getLeft();
+    const node_ptr& b = right->getRight();
+    if (node_type::height(b) >= node_type::height(a)) {
+      // Single left rotation
+      return makeNode(right->getItem(), makeNode(item, left, a), b);
+    }
+    // Right-left double rotation
+    return makeNode(a->getItem(), makeNode(item, left, a->getLeft()),
+                    makeNode(right->getItem(), a->getRight(), b));
+  }
+  return makeNode(item, left, right);
+}
+
+// Helper for insert that copies the path down to the key
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::node_ptr PersistentAVLTree<Key, Value>::insertHelper(
+    const node_ptr& curr, const std::pair<const Key, Value>& keyValuePair)
+{
+  if (!curr) {
+    return makeNode(keyValuePair, node_ptr(), node_ptr());
+  }
+  if (keyValuePair.first < curr->getKey()) {
+    return balance(curr->getItem(), insertHelper(curr->getLeft(), keyValuePair), curr->getRight());
+  }
+  if (curr->getKey() < keyValuePair.first) {
+    return balance(curr->getItem(), curr->getLeft(), insertHelper(curr->getRight(), keyValuePair));
+  }
+  // Same key, only the value changes
+  return makeNode(keyValuePair, curr->getLeft(), curr->getRight());
+}
+
+// Helper for remove that copies the path down to the key. When the key
+// is missing nothing is copied and the same subtree comes back. A node
+// with two children is replaced by its predecessor, like AVLTree does.
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::node_ptr PersistentAVLTree<Key, Value>::removeHelper(
+    const node_ptr& curr, const Key& key)
+{
+  if (!curr) {
+    return curr;
+  }
+  if (key < curr->getKey()) {
+    node_ptr left = removeHelper(curr->getLeft(), key);
+    if (left == curr->getLeft()) {
+      return curr;
+    }
+    return balance(curr->getItem(), left, curr->getRight());
+  }
+  if (curr->getKey() < key) {
+    node_ptr right = removeHelper(curr->getRight(), key);
+    if (right == curr->getRight()) {
+      return curr;
+    }
+    return balance(curr->getItem(), curr->getLeft(), right);
+  }
+
+  if (!curr->getLeft()) {
+    return curr->getRight();
+  }
+  if (!curr->getRight()) {
+    return curr->getLeft();
+  }
+  const node_type* predecessor = NULL;
+  node_ptr left = removeLargest(curr->getLeft(), predecessor);
+  return balance(predecessor->getItem(), left, curr->getRight());
+}
+
+// Helper for removeHelper that takes the largest node out of a subtree
+// and reports it through largest. The old subtree still owns that node,
+// so it stays alive while the caller copies its item.
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::node_ptr PersistentAVLTree<Key, Value>::removeLargest(
+    const node_ptr& curr, const node_type*& largest)
+{
+  if (!curr->getRight()) {
+    largest = curr.get();
+    return curr->getLeft();
+  }
+  return balance(curr->getItem(), curr->getLeft(), removeLargest(curr->getRight(), largest));
+}
+
+/*
+  ----------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+#endif